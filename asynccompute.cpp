@@ -0,0 +1,110 @@
+#include "vk.h"
+
+AsyncCompute::AsyncCompute(std::shared_ptr<Device> deviceptr)
+: deviceptr(deviceptr), device(*deviceptr.get()),
+  pool(deviceptr, device.queueFamilies().computeFamily)
+{
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = pool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate compute command buffer!");
+    }
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS
+        || vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create compute synchronization objects!");
+    }
+}
+
+AsyncCompute::~AsyncCompute() {
+    vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+    vkDestroyFence(device, fence, nullptr);
+    vkDestroySemaphore(device, semaphore, nullptr);
+    vkFreeCommandBuffers(device, pool, 1, &commandBuffer);
+}
+
+bool AsyncCompute::dedicatedQueue() const {
+    return device.queueFamilies().computeFamily != device.queueFamilies().graphicsFamily;
+}
+
+VkCommandBuffer AsyncCompute::begin() {
+    if (signaled) {
+        throw std::runtime_error("previous compute submission was never waited on!");
+    }
+    vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+    vkResetCommandBuffer(commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    return commandBuffer;
+}
+
+void AsyncCompute::submit() {
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record compute command buffer!");
+    }
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &semaphore;
+
+    vkResetFences(device, 1, &fence);
+    if (vkQueueSubmit(device.compute(), 1, &submitInfo, fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit compute command buffer!");
+    }
+    signaled = true;
+}
+
+// Returns the semaphore the caller's next graphics submit must wait on, or
+// VK_NULL_HANDLE when no compute work is outstanding.
+VkSemaphore AsyncCompute::takeSemaphore() {
+    if (!signaled) {
+        return VK_NULL_HANDLE;
+    }
+    signaled = false;
+    return semaphore;
+}
+
+// Buffers read and written by both the compute and graphics queues are shared
+// concurrently instead of transferring ownership every frame.
+void createSharedBuffer(Device& device, VkDeviceSize size, VkBufferUsageFlags usage,
+                        VkMemoryPropertyFlags properties, MemoryCategory category,
+                        VkBuffer& buffer, VkDeviceMemory& memory)
+{
+    auto families = device.sharedQueueFamilies();
+
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    if (families.size() > 1) {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = families.size();
+        bufferInfo.pQueueFamilyIndices = families.data();
+    } else {
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
+
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create shared buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+    memory = device.allocateMemory(memRequirements, properties, category);
+    vkBindBufferMemory(device, buffer, memory, 0);
+}
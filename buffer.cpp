@@ -1,18 +1,21 @@
-static uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ( (typeFilter & (1 << i)) &&
-             (memProperties.memoryTypes[i].propertyFlags & properties) == properties) 
-        {
-            return i;
-        }
+static MemoryCategory categoryFor(VkBufferUsageFlags usage) {
+    if (usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT) {
+        return MEMORY_VERTEX;
     }
-
-    throw std::runtime_error("failed to find suitable memory type!");
+    if (usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT) {
+        return MEMORY_INDEX;
+    }
+    if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) {
+        return MEMORY_UNIFORM;
+    }
+    if (usage == VK_BUFFER_USAGE_TRANSFER_SRC_BIT) {
+        return MEMORY_STAGING;
+    }
+    return MEMORY_OTHER;
 }
 
-static void createBuffer(VkDeviceSize size,
+static void createBuffer(Device& device,
+                         VkDeviceSize size,
                          VkBufferUsageFlags usage,
                          VkMemoryPropertyFlags properties,
                          VkBuffer& buffer,
@@ -32,21 +35,12 @@ static void createBuffer(VkDeviceSize size,
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    auto res = vkAllocateMemory(device, &allocInfo, nullptr, &memory)
-    if (res != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate vertex buffer memory!");
-    }
-
+    memory = device.allocateMemory(memRequirements, properties, categoryFor(usage));
     vkBindBufferMemory(device, buffer, memory, 0);
 }
 
 Buffer::Buffer(std::sharedptr<Device> deviceptr,
-               CommandPool commandPool,
+               CommandPool& commandPool,
                void* contents,
                size_t size,
                VkBufferUsageFlags usageFlag)
@@ -55,7 +49,8 @@ Buffer::Buffer(std::sharedptr<Device> deviceptr,
     VkBuffer stagingBuffervkDestroyBuffer;
     VkDeviceMemory stagingBufferMemory;
 
-    createBuffer(size,
+    createBuffer(device,
+                 size,
                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                  stagingBuffer,
@@ -66,19 +61,20 @@ Buffer::Buffer(std::sharedptr<Device> deviceptr,
     memcpy(data, contents, size);
     vkUnmapMemory(device, stagingBufferMemory);
 
-    createBuffer(bufferSize,
+    createBuffer(device,
+                 bufferSize,
                  VK_BUFFER_USAGE_TRANSFER_DST_BIT | usageFlag,
                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                  buffer,
                  memory);
     copyBuffer(stagingBuffer, buffer, size);
 
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    device.freeMemory(stagingBufferMemory);
     vkDestroyBuffer(device, stagingBuffer, 
 }
 
 Buffer::~Buffer() {
-    vkFreeMemory(device, memory, nullptr);
+    device.freeMemory(memory);
     vkDestroyBuffer(device, buffer, nullptr);
 }
 
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include "vk.h"
+
+// Buffer slots, matching the bindings of cluster.comp.
+enum ClusterBinding {
+    MESHLETS,
+    MESHLET_VERTICES,
+    MESHLET_TRIANGLES,
+    DRAW_COMMAND,
+    CULLED_INDICES,
+    CLUSTER_BINDING_COUNT
+};
+
+// Workgroup counts per dimension every implementation must support.
+static const uint32_t maxGroupsX = 65535;
+
+ClusterCulling::ClusterCulling(std::shared_ptr<Device> deviceptr, ShaderCache& shaders,
+                               LayoutCache& layouts, DescriptorAllocator& descriptors,
+                               const MeshletData& data)
+: deviceptr(deviceptr), device(*deviceptr.get()), meshletCount(data.meshlets.size())
+{
+    auto shader = shaders.load("shaders/cluster.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+    pipeline.reset(new ComputePipeline(deviceptr, shader, layouts));
+
+    upload(MESHLETS, data.meshlets.data(), data.meshlets.size() * sizeof(Meshlet));
+    upload(MESHLET_VERTICES, data.vertices.data(), data.vertices.size() * sizeof(uint32_t));
+    upload(MESHLET_TRIANGLES, data.triangles.data(), data.triangles.size() * sizeof(uint32_t));
+
+    createSharedBuffer(device, sizeof(VkDrawIndexedIndirectCommand),
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+                       | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                       MEMORY_OTHER, buffers[DRAW_COMMAND], memory[DRAW_COMMAND]);
+    createSharedBuffer(device, std::max<size_t>(data.triangles.size(), 1) * 3 * sizeof(uint32_t),
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                       MEMORY_INDEX, buffers[CULLED_INDICES], memory[CULLED_INDICES]);
+
+    const auto& layout = layouts.pipelineLayout({&shader->reflection()});
+    set = descriptors.allocate(layout.setLayouts[0]->layout);
+
+    VkDescriptorBufferInfo infos[CLUSTER_BINDING_COUNT];
+    VkWriteDescriptorSet writes[CLUSTER_BINDING_COUNT] = {};
+    for (uint32_t i = 0; i < CLUSTER_BINDING_COUNT; i++) {
+        infos[i] = {buffers[i], 0, VK_WHOLE_SIZE};
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = set;
+        writes[i].dstBinding = i;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].descriptorCount = 1;
+        writes[i].pBufferInfo = &infos[i];
+    }
+    vkUpdateDescriptorSets(device, CLUSTER_BINDING_COUNT, writes, 0, nullptr);
+}
+
+ClusterCulling::~ClusterCulling() {
+    for (uint32_t i = 0; i < CLUSTER_BINDING_COUNT; i++) {
+        vkDestroyBuffer(device, buffers[i], nullptr);
+        device.freeMemory(memory[i]);
+    }
+}
+
+// Meshlet data never changes after load, so it stays in host-visible memory
+// written once rather than going through a staging copy.
+void ClusterCulling::upload(uint32_t binding, const void *data, VkDeviceSize size) {
+    createSharedBuffer(device, std::max<VkDeviceSize>(size, 4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                       MEMORY_VERTEX, buffers[binding], memory[binding]);
+    if (size) {
+        void *mapped;
+        vkMapMemory(device, memory[binding], 0, size, 0, &mapped);
+        memcpy(mapped, data, size);
+        vkUnmapMemory(device, memory[binding]);
+    }
+}
+
+// Recorded on the compute queue; the semaphore from AsyncCompute makes the
+// index buffer and draw command visible to draw().
+void ClusterCulling::cull(VkCommandBuffer cmd, const glm::mat4& viewProj,
+                          const glm::mat4& model, const glm::vec3& camera)
+{
+    VkDrawIndexedIndirectCommand reset = {0, 1, 0, 0, 0};
+    vkCmdUpdateBuffer(cmd, buffers[DRAW_COMMAND], 0, sizeof(reset), &reset);
+
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+
+    // Testing in object space avoids transforming every meshlet on the GPU.
+    ClusterConstants constants;
+    Frustum frustum = Frustum::fromMatrix(viewProj * model);
+    std::copy(frustum.planes, frustum.planes + 6, constants.planes);
+    constants.camera = glm::inverse(model) * glm::vec4(camera, 1.0f);
+    constants.meshletCount = meshletCount;
+
+    VkPipelineLayout layout = *pipeline;
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, *pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &set, 0, nullptr);
+    // The struct's tail padding is outside the shader's push constant range.
+    uint32_t size = offsetof(ClusterConstants, meshletCount) + sizeof(uint32_t);
+    vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, size, &constants);
+    uint32_t groupsX = std::min(meshletCount, maxGroupsX);
+    uint32_t groupsY = (meshletCount + maxGroupsX - 1) / maxGroupsX;
+    if (groupsX) {
+        vkCmdDispatch(cmd, groupsX, groupsY, 1);
+    }
+}
+
+// Replaces the bound index buffer; vertex buffers and descriptor sets are
+// the caller's.
+void ClusterCulling::draw(VkCommandBuffer cmd) {
+    vkCmdBindIndexBuffer(cmd, buffers[CULLED_INDICES], 0, VK_INDEX_TYPE_UINT32);
+    vkCmdDrawIndexedIndirect(cmd, buffers[DRAW_COMMAND], 0, 1,
+                             sizeof(VkDrawIndexedIndirectCommand));
+}
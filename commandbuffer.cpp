@@ -1,6 +1,6 @@
 #include "vk.h"
 
-CommandBuffer::CommandBuffer(std::shared_ptr<Device> deviceptr, CommandPool commandPool)
+CommandBuffer::CommandBuffer(std::shared_ptr<Device> deviceptr, CommandPool& commandPool)
 :deviceptr(deviceptr), device(*deviceptr.get()), commandPool(commandPool)
 {
 }
@@ -40,9 +40,18 @@ void CommandBuffer::endSingleTimeCommands() {
 }
 
 
+GpuProfiler *CommandBuffer::profiler = nullptr;
+
 void CommandBuffer::submitCommandBuffer() {
+    TRACE_SCOPE(name());
     beginSingleTimeCommands();
-    execute();
+    if (profiler) {
+        profiler->beginFrame(commandBuffer, 0);
+    }
+    {
+        GpuScope scope(profiler, commandBuffer, name());
+        execute();
+    }
     endSingleTimeCommands();
 }
 
@@ -80,7 +89,7 @@ void CommandBuffer::endSingleTimeCommands() {
 }
 
 ImageTransitionCmdBuffer::ImageTransitionCmdBuffer(shared_ptr<Device> deviceptr,
-                                                   CommandPool commandPool
+                                                   CommandPool& commandPool
                                                    Image image,
                                                    VkImageLayout oldLayout,
                                                    VkImageLayout newLayout);
@@ -148,7 +157,7 @@ void TransitionImageLayoutCommandBuffer::execute() {
 }
 
 CopyBufCmdBuffer::CopyBufCmdBuffer(shared_ptr<Device> deviceptr,
-                                   CommandPool commandPool,
+                                   CommandPool& commandPool,
                                    VkBuffer& src,
                                    VkBuffer& dst,
                                    VkDeviceSize size)
@@ -163,7 +172,7 @@ void CopyBufCmdBuffer::execute() {
 }
 
 CopyImageCmdBuffer::CopyImageCmdBuffer(shared_ptr<Device> deviceptr,
-                                       CommandPool commandPool,
+                                       CommandPool& commandPool,
                                        Image src,
                                        Image dst)
 : CommandBuffer(deviceptr, commandPool),
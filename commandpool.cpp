@@ -1,14 +1,32 @@
-CommandPool::CommandPool(std::shared_ptr<Device> deviceptr)
+CommandPool::CommandPool(std::shared_ptr<Device> deviceptr, int queueFamily,
+                         VkCommandPoolCreateFlags flags)
 : deviceptr(deviceptr), device(*deviceptr.get())
 {
-    QueueFamilyIndices queueFamilyIndices = device.findQueueFamilies();
+    if (queueFamily < 0) {
+        queueFamily = device.queueFamilies().graphicsFamily;
+    }
 
     VkCommandPoolCreateInfo info = {};
     info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    info.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
+    info.queueFamilyIndex = queueFamily;
+    info.flags = flags;
 
     auto res = vkCreateCommandPool(device, &info, nullptr, &pool);
     if (res != VK_SUCCESS) {
             throw std::runtime_error("failed to create command pool!");
     }
 }
+
+// Also frees every command buffer still allocated from the pool.
+CommandPool::~CommandPool() {
+    vkDestroyCommandPool(device, pool, nullptr);
+}
+
+// Returns every command buffer allocated from the pool to the initial state
+// at once, which is cheaper than resetting them one by one. None of them
+// may be pending.
+void CommandPool::reset() {
+    if (vkResetCommandPool(device, pool, 0) != VK_SUCCESS) {
+        throw std::runtime_error("failed to reset command pool!");
+    }
+}
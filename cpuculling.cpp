@@ -0,0 +1,220 @@
+#include <cmath>
+#include "vk.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CULL_X86
+#endif
+
+// Gribb-Hartmann plane extraction for Vulkan's [0, 1] depth range. Planes
+// point inwards and are normalized so sphere tests can use the radius.
+Frustum Frustum::fromMatrix(const glm::mat4& m) {
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    Frustum frustum;
+    frustum.planes[0] = row3 + row0;
+    frustum.planes[1] = row3 - row0;
+    frustum.planes[2] = row3 + row1;
+    frustum.planes[3] = row3 - row1;
+    frustum.planes[4] = row2;
+    frustum.planes[5] = row3 - row2;
+    for (int i = 0; i < 6; i++) {
+        frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+    }
+    return frustum;
+}
+
+// Every kernel walks whole blocks of eight spheres and writes base + lane
+// for each visible lane. The write is unconditional and only the cursor
+// advance depends on the mask, so there is no branch per object. Padding
+// lanes have radius -inf and never pass.
+static inline uint32_t *emit(uint32_t *out, uint32_t base, uint32_t mask) {
+    for (uint32_t lane = 0; lane < 8; lane++) {
+        *out = base + lane;
+        out += (mask >> lane) & 1;
+    }
+    return out;
+}
+
+typedef uint32_t *(*CullKernel)(const float *x, const float *y, const float *z,
+                                const float *radius, uint32_t count,
+                                const float *planes, uint32_t *out);
+
+static uint32_t *cullScalar(const float *x, const float *y, const float *z,
+                            const float *radius, uint32_t count,
+                            const float *planes, uint32_t *out)
+{
+    for (uint32_t i = 0; i < count; i += 8) {
+        uint32_t mask = 0;
+        for (uint32_t lane = 0; lane < 8; lane++) {
+            uint32_t j = i + lane;
+            bool inside = true;
+            for (int p = 0; p < 6; p++) {
+                const float *plane = planes + p * 4;
+                float distance = x[j] * plane[0] + y[j] * plane[1] + z[j] * plane[2] + plane[3];
+                inside &= distance >= -radius[j];
+            }
+            mask |= (uint32_t) inside << lane;
+        }
+        out = emit(out, i, mask);
+    }
+    return out;
+}
+
+#ifdef CULL_X86
+
+// SSE2 is part of the x86-64 baseline: two 4-wide halves per block.
+static uint32_t *cullSse(const float *x, const float *y, const float *z,
+                         const float *radius, uint32_t count,
+                         const float *planes, uint32_t *out)
+{
+    __m128 px[6], py[6], pz[6], pw[6];
+    for (int p = 0; p < 6; p++) {
+        px[p] = _mm_set1_ps(planes[p * 4 + 0]);
+        py[p] = _mm_set1_ps(planes[p * 4 + 1]);
+        pz[p] = _mm_set1_ps(planes[p * 4 + 2]);
+        pw[p] = _mm_set1_ps(planes[p * 4 + 3]);
+    }
+
+    for (uint32_t i = 0; i < count; i += 8) {
+        uint32_t mask = 0;
+        for (uint32_t half = 0; half < 8; half += 4) {
+            uint32_t j = i + half;
+            __m128 cx = _mm_loadu_ps(x + j);
+            __m128 cy = _mm_loadu_ps(y + j);
+            __m128 cz = _mm_loadu_ps(z + j);
+            __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + j));
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p < 6; p++) {
+                __m128 distance = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(cx, px[p]), _mm_mul_ps(cy, py[p])),
+                    _mm_add_ps(_mm_mul_ps(cz, pz[p]), pw[p]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+            }
+            mask |= (uint32_t) _mm_movemask_ps(inside) << half;
+        }
+        out = emit(out, i, mask);
+    }
+    return out;
+}
+
+// compactLanes[mask] holds the set lanes of mask packed into the low bytes,
+// so AVX2 compacts a block with one table lookup and a widening move.
+struct LaneTable {
+    uint64_t lanes[256];
+
+    LaneTable() {
+        for (uint32_t mask = 0; mask < 256; mask++) {
+            uint64_t packed = 0;
+            uint32_t n = 0;
+            for (uint32_t lane = 0; lane < 8; lane++) {
+                if (mask & (1 << lane)) {
+                    packed |= (uint64_t) lane << (n++ * 8);
+                }
+            }
+            lanes[mask] = packed;
+        }
+    }
+};
+
+static const LaneTable compactLanes;
+
+__attribute__((target("avx2,fma")))
+static uint32_t *cullAvx2(const float *x, const float *y, const float *z,
+                          const float *radius, uint32_t count,
+                          const float *planes, uint32_t *out)
+{
+    __m256 px[6], py[6], pz[6], pw[6];
+    for (int p = 0; p < 6; p++) {
+        px[p] = _mm256_set1_ps(planes[p * 4 + 0]);
+        py[p] = _mm256_set1_ps(planes[p * 4 + 1]);
+        pz[p] = _mm256_set1_ps(planes[p * 4 + 2]);
+        pw[p] = _mm256_set1_ps(planes[p * 4 + 3]);
+    }
+
+    for (uint32_t i = 0; i < count; i += 8) {
+        __m256 cx = _mm256_loadu_ps(x + i);
+        __m256 cy = _mm256_loadu_ps(y + i);
+        __m256 cz = _mm256_loadu_ps(z + i);
+        __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(radius + i));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            __m256 distance = _mm256_fmadd_ps(cx, px[p],
+                              _mm256_fmadd_ps(cy, py[p],
+                              _mm256_fmadd_ps(cz, pz[p], pw[p])));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+        }
+
+        // All eight lanes are stored and the cursor moves by the popcount.
+        uint32_t mask = _mm256_movemask_ps(inside);
+        // A 64-bit load rather than _mm_cvtsi64_si128, which i386 lacks.
+        __m128i lanes = _mm_loadl_epi64((const __m128i*) &compactLanes.lanes[mask]);
+        __m256i indices = _mm256_add_epi32(_mm256_cvtepu8_epi32(lanes), _mm256_set1_epi32(i));
+        _mm256_storeu_si256((__m256i*) out, indices);
+        out += __builtin_popcount(mask);
+    }
+    return out;
+}
+
+#endif
+
+static CullKernel selectKernel(const char **name) {
+#ifdef CULL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        *name = "avx2";
+        return cullAvx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        *name = "sse2";
+        return cullSse;
+    }
+#endif
+    *name = "scalar";
+    return cullScalar;
+}
+
+static const char *kernelName = nullptr;
+static const CullKernel kernel = selectKernel(&kernelName);
+
+const char *CpuCulling::isa() {
+    return kernelName;
+}
+
+uint32_t CpuCulling::add(const glm::vec4& sphere) {
+    if (count % 8 == 0) {
+        x.resize(count + 8, 0.0f);
+        y.resize(count + 8, 0.0f);
+        z.resize(count + 8, 0.0f);
+        radius.resize(count + 8, -INFINITY);
+    }
+    set(count, sphere);
+    return count++;
+}
+
+void CpuCulling::set(uint32_t object, const glm::vec4& sphere) {
+    x[object] = sphere.x;
+    y[object] = sphere.y;
+    z[object] = sphere.z;
+    radius[object] = sphere.w;
+}
+
+void CpuCulling::clear() {
+    x.clear();
+    y.clear();
+    z.clear();
+    radius.clear();
+    count = 0;
+}
+
+// visible is overwritten with the indices of the spheres that intersect the
+// frustum, in ascending order.
+void CpuCulling::cull(const Frustum& frustum, std::vector<uint32_t>& visible) const {
+    visible.resize(x.size());
+    uint32_t *end = kernel(x.data(), y.data(), z.data(), radius.data(), x.size(),
+                           &frustum.planes[0].x, visible.data());
+    visible.resize(end - visible.data());
+}
@@ -0,0 +1,114 @@
+#include <cstdlib>
+#include <cstring>
+#include "vk.h"
+
+static const char *levelNames[] = {"off", "core", "sync", "best-practices"};
+
+static DebugConfig config = {
+#ifdef NDEBUG
+    VALIDATION_OFF,
+#else
+    VALIDATION_CORE,
+#endif
+};
+
+static ValidationLevel parseLevel(const char *name) {
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(name, levelNames[i]) == 0) {
+            return (ValidationLevel) i;
+        }
+    }
+    throw std::runtime_error(std::string("unknown validation level ") + name);
+}
+
+// Command line options take precedence over the environment.
+void DebugConfig::parse(int argc, char **argv) {
+    const char *level = getenv("VK_VALIDATION");
+    const char *frames = getenv("VK_BENCHMARK");
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--validation=", 13) == 0) {
+            level = argv[i] + 13;
+        } else if (strncmp(argv[i], "--benchmark=", 12) == 0) {
+            frames = argv[i] + 12;
+        }
+    }
+
+    if (level) {
+        config.validation = parseLevel(level);
+    }
+    if (frames) {
+        config.benchmarkFrames = strtoul(frames, nullptr, 10);
+    }
+#ifdef NDEBUG
+    if (config.validation != VALIDATION_OFF) {
+        std::cout << "validation is compiled out of release builds" << std::endl;
+        config.validation = VALIDATION_OFF;
+    }
+#endif
+}
+
+const DebugConfig& DebugConfig::get() {
+    return config;
+}
+
+const std::vector<const char*>& DebugConfig::layers() const {
+    static const std::vector<const char*> none;
+    static const std::vector<const char*> khronos = {"VK_LAYER_KHRONOS_validation"};
+    return validationEnabled() ? khronos : none;
+}
+
+const char *DebugConfig::levelName() const {
+    return levelNames[validation];
+}
+
+#ifndef NDEBUG
+
+static PFN_vkSetDebugUtilsObjectNameEXT setObjectName = nullptr;
+static PFN_vkCmdBeginDebugUtilsLabelEXT cmdBeginLabel = nullptr;
+static PFN_vkCmdEndDebugUtilsLabelEXT cmdEndLabel = nullptr;
+
+namespace debug {
+
+void load(VkInstance instance) {
+    if (!config.validationEnabled()) {
+        return;
+    }
+    setObjectName = (PFN_vkSetDebugUtilsObjectNameEXT)
+        vkGetInstanceProcAddr(instance, "vkSetDebugUtilsObjectNameEXT");
+    cmdBeginLabel = (PFN_vkCmdBeginDebugUtilsLabelEXT)
+        vkGetInstanceProcAddr(instance, "vkCmdBeginDebugUtilsLabelEXT");
+    cmdEndLabel = (PFN_vkCmdEndDebugUtilsLabelEXT)
+        vkGetInstanceProcAddr(instance, "vkCmdEndDebugUtilsLabelEXT");
+}
+
+void setName(VkDevice device, VkObjectType type, uint64_t handle, const char *name) {
+    if (!setObjectName) {
+        return;
+    }
+    VkDebugUtilsObjectNameInfoEXT info = {};
+    info.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT;
+    info.objectType = type;
+    info.objectHandle = handle;
+    info.pObjectName = name;
+    setObjectName(device, &info);
+}
+
+void beginLabel(VkCommandBuffer commandBuffer, const char *name) {
+    if (!cmdBeginLabel) {
+        return;
+    }
+    VkDebugUtilsLabelEXT label = {};
+    label.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
+    label.pLabelName = name;
+    cmdBeginLabel(commandBuffer, &label);
+}
+
+void endLabel(VkCommandBuffer commandBuffer) {
+    if (cmdEndLabel) {
+        cmdEndLabel(commandBuffer);
+    }
+}
+
+}
+
+#endif
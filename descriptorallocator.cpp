@@ -0,0 +1,120 @@
+#include <algorithm>
+#include "vk.h"
+
+// Pools are handed out whole and never freed individually: sets live until
+// reset() recycles every pool the allocator has touched.
+static const uint32_t maxSetsPerPool = 4096;
+
+DescriptorAllocator::DescriptorAllocator(std::shared_ptr<Device> deviceptr,
+                                         uint32_t setsPerPool,
+                                         std::vector<DescriptorPoolRatio> ratios)
+: deviceptr(deviceptr), device(*deviceptr.get()), ratios(ratios),
+  setsPerPool(setsPerPool)
+{
+}
+
+DescriptorAllocator::~DescriptorAllocator() {
+    for (auto pool : usedPools) {
+        vkDestroyDescriptorPool(device, pool, nullptr);
+    }
+    for (auto pool : freePools) {
+        vkDestroyDescriptorPool(device, pool, nullptr);
+    }
+}
+
+std::vector<DescriptorPoolRatio> DescriptorAllocator::defaultRatios() {
+    return {
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.0f},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.0f},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1.0f},
+    };
+}
+
+VkDescriptorPool DescriptorAllocator::createPool(uint32_t maxSets) {
+    std::vector<VkDescriptorPoolSize> sizes;
+    sizes.reserve(ratios.size());
+    for (const auto& ratio : ratios) {
+        VkDescriptorPoolSize size = {};
+        size.type = ratio.type;
+        size.descriptorCount = std::max(1u, (uint32_t) (ratio.ratio * maxSets));
+        sizes.push_back(size);
+    }
+
+    VkDescriptorPoolCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    info.poolSizeCount = sizes.size();
+    info.pPoolSizes = sizes.data();
+    info.maxSets = maxSets;
+
+    VkDescriptorPool pool;
+    auto res = vkCreateDescriptorPool(device, &info, nullptr, &pool);
+    if (res != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor pool!");
+    }
+    return pool;
+}
+
+VkDescriptorPool DescriptorAllocator::grabPool() {
+    if (!freePools.empty()) {
+        auto pool = freePools.back();
+        freePools.pop_back();
+        return pool;
+    }
+
+    auto pool = createPool(setsPerPool);
+    setsPerPool = std::min(setsPerPool * 2, maxSetsPerPool);
+    return pool;
+}
+
+VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout) {
+    if (current == VK_NULL_HANDLE) {
+        current = grabPool();
+        usedPools.push_back(current);
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = current;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+
+    VkDescriptorSet set;
+    auto res = vkAllocateDescriptorSets(device, &allocInfo, &set);
+    if (res == VK_ERROR_FRAGMENTED_POOL || res == VK_ERROR_OUT_OF_POOL_MEMORY_KHR) {
+        current = grabPool();
+        usedPools.push_back(current);
+        allocInfo.descriptorPool = current;
+        res = vkAllocateDescriptorSets(device, &allocInfo, &set);
+    }
+    if (res != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate descriptor set!");
+    }
+    return set;
+}
+
+void DescriptorAllocator::reset() {
+    for (auto pool : usedPools) {
+        vkResetDescriptorPool(device, pool, 0);
+        freePools.push_back(pool);
+    }
+    usedPools.clear();
+    current = VK_NULL_HANDLE;
+}
+
+FrameDescriptorAllocator::FrameDescriptorAllocator(std::shared_ptr<Device> deviceptr,
+                                                   uint32_t framesInFlight)
+{
+    for (uint32_t i = 0; i < framesInFlight; i++) {
+        frames.emplace_back(new DescriptorAllocator(deviceptr));
+    }
+}
+
+void FrameDescriptorAllocator::beginFrame(uint32_t index) {
+    frameIndex = index % frames.size();
+    frames[frameIndex]->reset();
+}
+
+VkDescriptorSet FrameDescriptorAllocator::allocate(VkDescriptorSetLayout layout) {
+    return frames[frameIndex]->allocate(layout);
+}
@@ -1,118 +1,176 @@
+#include <chrono>
+
+// Packed in binding order; matches the update template built from the layout.
+struct DescriptorSetData {
+    VkDescriptorBufferInfo ubo;
+    VkDescriptorImageInfo texture;
+};
+
 class DescriptorSet {
 public:
-    DescriptorSet();
+    DescriptorSet(shared_ptr<Device> deviceptr, DescriptorAllocator& allocator,
+                  const DescriptorSetLayoutInfo& layoutInfo);
     ~DescriptorSet();
     operator VkDescriptorSet() { return set };
     operator VkDescriptorSetLayout() { return layout };
-    operator VkDescriptorPool() { return pool };
+
+    void update(const DescriptorSetData& data);
+    void write(const DescriptorSetData& data);
+    void benchmarkUpdates(uint32_t iterations);
 
 private:
     shared_ptr<Device> deviceptr;
     Device device;
+    DescriptorAllocator& allocator;
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
     VkDescriptorSetLayout layout;
-    VkDescriptorPool pool;
     VkDescriptorSet set;
+    VkDescriptorUpdateTemplateKHR updateTemplate = VK_NULL_HANDLE;
+    PFN_vkUpdateDescriptorSetWithTemplateKHR updateWithTemplate = nullptr;
 
-    void createLayout();
-    void createPool();
+    void createUpdateTemplate();
     void createSet();
 };
 
-DescriptorSet::DescriptorSet(shared_ptr<Device> deviceptr)
-: deviceptr(deviceptr), device(*deviceptr.get())
+DescriptorSet::DescriptorSet(shared_ptr<Device> deviceptr, DescriptorAllocator& allocator,
+                             const DescriptorSetLayoutInfo& layoutInfo)
+: deviceptr(deviceptr), device(*deviceptr.get()), allocator(allocator),
+  bindings(layoutInfo.bindings), layout(layoutInfo.layout)
 {
-    createLayout();
-    createPool();
+    createUpdateTemplate();
     createSet();
 }
 
 DescriptorSet::~DescriptorSet() {
-    vkDestroyDescriptorPool(device, pool)
-    vkDestroyDescriptorSetLayout(device, layout)
+    if (updateTemplate != VK_NULL_HANDLE) {
+        auto destroy = (PFN_vkDestroyDescriptorUpdateTemplateKHR) vkGetDeviceProcAddr(device, "vkDestroyDescriptorUpdateTemplateKHR");
+        destroy(device, updateTemplate, nullptr);
+    }
 }
 
-void DescriptorSet::createSet() {
-    VkDescriptorSetLayout layouts[] = {layout};
-    VkDescriptorSetAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = 1;
-    allocInfo.pSetLayouts = layouts;
-    if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate descriptor set!");
+// The template is built from the layout bindings that DescriptorSetData
+// mirrors, so this is the only payload both paths can write.
+void DescriptorSet::update(const DescriptorSetData& data) {
+    if (updateTemplate == VK_NULL_HANDLE) {
+        write(data);
+        return;
     }
+    updateWithTemplate(device, set, updateTemplate, &data);
+}
 
-    std::array<VkWriteDescriptorSet, 2> writes = {};
+void DescriptorSet::createSet() {
+    set = allocator.allocate(layout);
 
-    VkDescriptorBufferInfo bufferInfo = {};
-    bufferInfo.buffer = uniformBuffer;
-    bufferInfo.offset = 0;
-    bufferInfo.range = sizeof(UniformBufferObject);
+    DescriptorSetData data = {};
+    data.ubo.buffer = uniformBuffer;
+    data.ubo.offset = 0;
+    data.ubo.range = sizeof(UniformBufferObject);
+
+    data.texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    data.texture.imageView = textureImageView;
+    data.texture.sampler = textureSampler;
+
+    update(data);
+}
+
+void DescriptorSet::write(const DescriptorSetData& data) {
+    std::array<VkWriteDescriptorSet, 2> writes = {};
 
     writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writes[0].dstSet = descriptorSet;
+    writes[0].dstSet = set;
     writes[0].dstBinding = 0;
     writes[0].dstArrayElement = 0;
     writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     writes[0].descriptorCount = 1;
-    writes[0].pBufferInfo = &bufferInfo;
-
-    VkDescriptorImageInfo imageInfo = {};
-    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    imageInfo.imageView = textureImageView;
-    imageInfo.sampler = textureSampler;
+    writes[0].pBufferInfo = &data.ubo;
 
     writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writes[1].dstSet = descriptorSet;
+    writes[1].dstSet = set;
     writes[1].dstBinding = 1;
     writes[1].dstArrayElement = 0;
     writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     writes[1].descriptorCount = 1;
-    writes[1].pImageInfo = &imageInfo;
+    writes[1].pImageInfo = &data.texture;
 
     vkUpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
 }
 
-void DescriptorSet::createLayout() {
-    VkDescriptorSetLayoutBinding uboBinding = {};
-    uboBinding.binding = 0;
-    uboBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    uboBinding.descriptorCount = 1;
-    uboBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-    VkDescriptorSetLayoutBinding sampleBinding = {};
-    sampleBinding.binding = 1;
-    sampleBinding.descriptorCount = 1;
-    sampleBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    sampleBinding.pImmutableSamplers = nullptr;
-    sampleBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {uboBinding, sampleBinding};
-    VkDescriptorSetLayoutCreateInfo info = {};
-    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    info.bindingCount = bindings.size();
-    info.pBindings = bindings.data();
-
-    if (vkCreateDescriptorSetLayout(device, &info, nullptr, &layout) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create descriptor set layout!");
+static size_t descriptorInfoSize(VkDescriptorType type) {
+    switch (type) {
+    case VK_DESCRIPTOR_TYPE_SAMPLER:
+    case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+    case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+    case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+    case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+        return sizeof(VkDescriptorImageInfo);
+    case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+    case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+        return sizeof(VkBufferView);
+    default:
+        return sizeof(VkDescriptorBufferInfo);
     }
 }
 
-void DescriptorSet::createPool() {
-    std::array<VkDescriptorPoolSize, 2> sizes = {};
-    sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    sizes[0].descriptorCount = 1;
-    sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    sizes[1].descriptorCount = 1;
-
-    VkDescriptorPoolCreateInfo info = {};
-    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    info.poolSizeCount = sizes.size();
-    info.pPoolSizes = sizes.data();
-    info.maxSets = 1;
-
-    auto res = vkCreateDescriptorPool(device, &info, nullptr, &pool)
-    if (res != VK_SUCCESS) {
-            throw std::runtime_error("failed to create descriptor pool!");
+void DescriptorSet::createUpdateTemplate() {
+    if (!device.hasExtension(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME)) {
+        return;
+    }
+    auto create = (PFN_vkCreateDescriptorUpdateTemplateKHR) vkGetDeviceProcAddr(device, "vkCreateDescriptorUpdateTemplateKHR");
+    updateWithTemplate = (PFN_vkUpdateDescriptorSetWithTemplateKHR) vkGetDeviceProcAddr(device, "vkUpdateDescriptorSetWithTemplateKHR");
+
+    std::vector<VkDescriptorUpdateTemplateEntryKHR> entries;
+    size_t offset = 0;
+    for (const auto& binding : bindings) {
+        size_t stride = descriptorInfoSize(binding.descriptorType);
+
+        VkDescriptorUpdateTemplateEntryKHR entry = {};
+        entry.dstBinding = binding.binding;
+        entry.dstArrayElement = 0;
+        entry.descriptorCount = binding.descriptorCount;
+        entry.descriptorType = binding.descriptorType;
+        entry.offset = offset;
+        entry.stride = stride;
+        entries.push_back(entry);
+
+        offset += stride * binding.descriptorCount;
+    }
+
+    VkDescriptorUpdateTemplateCreateInfoKHR info = {};
+    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO_KHR;
+    info.descriptorUpdateEntryCount = entries.size();
+    info.pDescriptorUpdateEntries = entries.data();
+    info.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET_KHR;
+    info.descriptorSetLayout = layout;
+
+    if (create(device, &info, nullptr, &updateTemplate) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor update template!");
+    }
+}
+
+void DescriptorSet::benchmarkUpdates(uint32_t iterations) {
+    DescriptorSetData data = {};
+    data.ubo.buffer = uniformBuffer;
+    data.ubo.range = sizeof(UniformBufferObject);
+    data.texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    data.texture.imageView = textureImageView;
+    data.texture.sampler = textureSampler;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        write(data);
+    }
+    auto mid = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        update(data);
     }
+    auto end = std::chrono::steady_clock::now();
+
+    std::chrono::duration<double> writeTime = mid - start;
+    std::chrono::duration<double> templateTime = end - mid;
+    std::cout << "vkUpdateDescriptorSets: "
+              << iterations / writeTime.count() << " writes/s" << std::endl;
+    std::cout << "update template: "
+              << iterations / templateTime.count() << " writes/s"
+              << (updateTemplate == VK_NULL_HANDLE ? " (unsupported, fallback)" : "")
+              << std::endl;
 }
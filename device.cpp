@@ -1,10 +1,20 @@
 #include <set>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
 #include "vk.h"
 
 const std::vector<const char*> deviceExtensions = {
         VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+const std::vector<const char*> optionalDeviceExtensions = {
+        VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME,
+        VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+        VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME
+};
+
 Device::Device(VkInstance instance, VkSurfaceKHR surface)
 : instance(instance), physical(VK_NULL_HANDLE), logical(VK_NULL_HANDLE),
   surface(surface)
@@ -17,6 +27,124 @@ Device::~Device() {
     vkDestroyDevice(logical, nullptr);
 }
 
+std::string Device::selection;
+
+// --device=<index|name substring|UUID> or VK_DEVICE pins the physical device;
+// the command line takes precedence.
+void Device::parseSelection(int argc, char **argv) {
+    const char *value = getenv("VK_DEVICE");
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--device=", 9) == 0) {
+            value = argv[i] + 9;
+        }
+    }
+    selection = value ? value : "";
+}
+
+static std::string formatUUID(const uint8_t *uuid) {
+    static const char *hex = "0123456789abcdef";
+    std::string text;
+    for (int i = 0; i < VK_UUID_SIZE; i++) {
+        if (i == 4 || i == 6 || i == 8 || i == 10) {
+            text += '-';
+        }
+        text += hex[uuid[i] >> 4];
+        text += hex[uuid[i] & 0xf];
+    }
+    return text;
+}
+
+// Prefers the driver's deviceUUID, which is stable across runs and APIs;
+// falls back to the pipeline cache UUID without the properties2 extension.
+static std::string deviceUUID(VkInstance instance, VkPhysicalDevice device,
+                              const VkPhysicalDeviceProperties& properties)
+{
+    auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)
+        vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR");
+    if (!getProperties2) {
+        return formatUUID(properties.pipelineCacheUUID);
+    }
+    VkPhysicalDeviceIDPropertiesKHR id = {};
+    id.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES_KHR;
+    VkPhysicalDeviceProperties2KHR properties2 = {};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+    properties2.pNext = &id;
+    getProperties2(device, &properties2);
+    return formatUUID(id.deviceUUID);
+}
+
+static std::string lowercase(std::string text) {
+    for (auto& c : text) {
+        c = tolower(c);
+    }
+    return text;
+}
+
+static const char *deviceTypeName(VkPhysicalDeviceType type) {
+    switch (type) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+    case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+    default: return "other";
+    }
+}
+
+static VkDeviceSize deviceLocalMemory(VkPhysicalDevice device) {
+    VkPhysicalDeviceMemoryProperties memory;
+    vkGetPhysicalDeviceMemoryProperties(device, &memory);
+    VkDeviceSize size = 0;
+    for (uint32_t i = 0; i < memory.memoryHeapCount; i++) {
+        if (memory.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            size = std::max(size, memory.memoryHeaps[i].size);
+        }
+    }
+    return size;
+}
+
+// Device type dominates; VRAM, texture limits and dedicated compute or
+// transfer queues break ties between adapters of the same kind.
+int Device::scoreDevice(VkPhysicalDevice device) {
+    if (!isDeviceSuitable(device)) {
+        return -1;
+    }
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+
+    int score = 0;
+    switch (properties.deviceType) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score += 10000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score += 5000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score += 2000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU: break;
+    default: score += 1000; break;
+    }
+
+    VkDeviceSize gigabytes = deviceLocalMemory(device) >> 30;
+    score += std::min<VkDeviceSize>(gigabytes, 32) * 100;
+    score += properties.limits.maxImageDimension2D / 1024;
+
+    uint32_t count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &count, nullptr);
+    std::vector<VkQueueFamilyProperties> families(count);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &count, families.data());
+    bool asyncCompute = false;
+    bool transfer = false;
+    for (const auto& family : families) {
+        if ((family.queueFlags & VK_QUEUE_COMPUTE_BIT)
+            && !(family.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+            asyncCompute = true;
+        }
+        if (family.queueFlags == VK_QUEUE_TRANSFER_BIT
+            || family.queueFlags == (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_SPARSE_BINDING_BIT)) {
+            transfer = true;
+        }
+    }
+    score += asyncCompute ? 200 : 0;
+    score += transfer ? 100 : 0;
+    return score;
+}
+
 void Device::pickPhysicalDevice() {
     uint32_t deviceCount = 0;
     vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
@@ -28,20 +156,76 @@ void Device::pickPhysicalDevice() {
     std::vector<VkPhysicalDevice> devices(deviceCount);
     vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
-    for (const auto& device : devices) {
-        if (isDeviceSuitable(device)) {
+    struct Candidate {
+        uint32_t index;
+        VkPhysicalDevice device;
+        VkPhysicalDeviceProperties properties;
+        std::string uuid;
+        int score;
+    };
+    std::vector<Candidate> candidates;
+    for (uint32_t i = 0; i < deviceCount; i++) {
+        Candidate candidate = {i, devices[i]};
+        vkGetPhysicalDeviceProperties(devices[i], &candidate.properties);
+        candidate.uuid = deviceUUID(instance, devices[i], candidate.properties);
+        candidate.score = scoreDevice(devices[i]);
+        candidates.push_back(candidate);
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const Candidate& a, const Candidate& b) { return a.score > b.score; });
+
+    std::cout << "Device ranking:" << std::endl;
+    for (const auto& candidate : candidates) {
+        std::cout << "\t[" << candidate.index << "] " << candidate.properties.deviceName
+                  << " (" << deviceTypeName(candidate.properties.deviceType) << ", "
+                  << (deviceLocalMemory(candidate.device) >> 20) << " MB, "
+                  << candidate.uuid << "): ";
+        if (candidate.score < 0) {
+            std::cout << "unsuitable" << std::endl;
+        } else {
+            std::cout << "score " << candidate.score << std::endl;
+        }
+    }
 
-            VkPhysicalDeviceProperties properties;
-            vkGetPhysicalDeviceProperties(device, &properties);
-            std::cout << "Using device " << properties.deviceName << std::endl;
-            physical = device;
-            break;
+    const Candidate *chosen = nullptr;
+    if (!selection.empty()) {
+        // A number is only ever an index; matching it against names too
+        // would pick a higher-ranked device whose name contains the digits.
+        bool numeric = selection.find_first_not_of("0123456789") == std::string::npos;
+        uint32_t index = 0;
+        if (numeric) {
+            // Checked by length first so stoul cannot overflow.
+            if (selection.size() > 9 || (index = std::stoul(selection)) >= deviceCount) {
+                throw std::runtime_error("device index out of range: " + selection);
+            }
         }
+        for (const auto& candidate : candidates) {
+            bool matches = numeric
+                ? candidate.index == index
+                : lowercase(candidate.uuid) == lowercase(selection)
+                  || lowercase(candidate.properties.deviceName).find(lowercase(selection))
+                     != std::string::npos;
+            if (matches) {
+                chosen = &candidate;
+                break;
+            }
+        }
+        if (!chosen) {
+            throw std::runtime_error("no physical device matches " + selection);
+        }
+        if (chosen->score < 0) {
+            throw std::runtime_error(std::string("selected device is unsuitable: ")
+                                     + chosen->properties.deviceName);
+        }
+    } else if (candidates[0].score >= 0) {
+        chosen = &candidates[0];
     }
 
-    if (physical == VK_NULL_HANDLE) {
+    if (!chosen) {
         throw std::runtime_error("Failed to find a suitable GPU!");
     }
+    std::cout << "Using device " << chosen->properties.deviceName << std::endl;
+    physical = chosen->device;
 }
 
 QueueFamilyIndices Device::findQueueFamilies(VkPhysicalDevice device) {
@@ -77,9 +261,32 @@ QueueFamilyIndices Device::findQueueFamilies(VkPhysicalDevice device) {
         }
         i++;
     }
+
+    // Prefer a compute-only family so dispatches can overlap rasterization.
+    for (uint32_t j = 0; j < queueFamilies.size(); j++) {
+        if (queueFamilies[j].queueCount > 0
+            && (queueFamilies[j].queueFlags & VK_QUEUE_COMPUTE_BIT)
+            && !(queueFamilies[j].queueFlags & VK_QUEUE_GRAPHICS_BIT))
+        {
+            indices.computeFamily = j;
+            break;
+        }
+    }
+    if (indices.computeFamily < 0) {
+        indices.computeFamily = indices.graphicsFamily;
+    }
     return indices;
 }
 
+bool Device::hasExtension(const char *name) {
+    for (const char *enabled : enabledExtensions) {
+        if (strcmp(name, enabled) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 QueueFamilyIndices Device::findQueueFamilies() {
     return findQueueFamilies(physical);
 }
@@ -122,13 +329,15 @@ bool Device::isDeviceSuitable(VkPhysicalDevice device) {
 
 void Device::createLogicalDevice() {
     QueueFamilyIndices indices = findQueueFamilies(physical);
+    families = indices;
 
     float queuePriority = 1.0f;
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<int> uniqueQueueFamilies = {
         indices.graphicsFamily,
-        indices.presentFamily
+        indices.presentFamily,
+        indices.computeFamily
     };
 
     for (int queueFamily : uniqueQueueFamilies) {
@@ -142,30 +351,60 @@ void Device::createLogicalDevice() {
 
     VkDeviceCreateInfo createInfo = {};
 
+    // Query instrumentation and GPU-driven drawing are optional; enable them
+    // wherever the device has them.
+    VkPhysicalDeviceFeatures supported;
+    vkGetPhysicalDeviceFeatures(physical, &supported);
     VkPhysicalDeviceFeatures deviceFeatures = {};
+    deviceFeatures.pipelineStatisticsQuery = supported.pipelineStatisticsQuery;
+    deviceFeatures.occlusionQueryPrecise = supported.occlusionQueryPrecise;
+    deviceFeatures.inheritedQueries = supported.inheritedQueries;
+    deviceFeatures.multiDrawIndirect = supported.multiDrawIndirect;
+    deviceFeatures.drawIndirectFirstInstance = supported.drawIndirectFirstInstance;
+    enabledFeatures = deviceFeatures;
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
     createInfo.queueCreateInfoCount = (uint32_t) queueCreateInfos.size();
 
     createInfo.pEnabledFeatures = &deviceFeatures;
 
-    createInfo.enabledExtensionCount = 0;
-    createInfo.enabledExtensionCount = deviceExtensions.size();
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
-
-    if (enableValidationLayers) {
-        createInfo.enabledLayerCount = validationLayers.size();
-        createInfo.ppEnabledLayerNames = validationLayers.data();
-    } else {
-        createInfo.enabledLayerCount = 0;
+    enabledExtensions = deviceExtensions;
+    uint32_t count;
+    vkEnumerateDeviceExtensionProperties(physical, nullptr, &count, nullptr);
+    std::vector<VkExtensionProperties> available(count);
+    vkEnumerateDeviceExtensionProperties(physical, nullptr, &count, available.data());
+    for (const char *name : optionalDeviceExtensions) {
+        for (const auto& extension : available) {
+            if (strcmp(name, extension.extensionName) == 0) {
+                enabledExtensions.push_back(name);
+                break;
+            }
+        }
     }
 
+    createInfo.enabledExtensionCount = enabledExtensions.size();
+    createInfo.ppEnabledExtensionNames = enabledExtensions.data();
+
+    createInfo.enabledLayerCount = DebugConfig::get().layers().size();
+    createInfo.ppEnabledLayerNames = DebugConfig::get().layers().data();
+
     auto res = vkCreateDevice(physicalDevice, &createInfo, nullptr, &logical);
     if (res != VK_SUCCESS) {
             throw std::runtime_error("failed to create logical device!");
     }
+    memoryTracker = std::make_shared<MemoryTracker>(
+        instance, physical, hasExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME));
     vkGetDeviceQueue(device, indices.graphicsFamily, 0, &graphicsQueue);
     vkGetDeviceQueue(device, indices.presentFamily, 0, &presentQueue);
+    vkGetDeviceQueue(device, indices.computeFamily, 0, &computeQueue);
+}
+
+std::vector<uint32_t> Device::sharedQueueFamilies() const {
+    std::vector<uint32_t> shared = {(uint32_t) families.graphicsFamily};
+    if (families.computeFamily != families.graphicsFamily) {
+        shared.push_back(families.computeFamily);
+    }
+    return shared;
 }
 
 
@@ -193,9 +432,9 @@ SwapChainSupport Device::querySwapChainSupport() {
 }
 
 
-uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+uint32_t Device::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
     VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+    vkGetPhysicalDeviceMemoryProperties(physical, &memProperties);
     for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
         if (
             (typeFilter & (1 << i))
@@ -207,6 +446,30 @@ uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
     throw std::runtime_error("failed to find suitable memory type!");
 }
 
+VkDeviceMemory Device::allocateMemory(const VkMemoryRequirements& requirements,
+                                      VkMemoryPropertyFlags properties,
+                                      MemoryCategory category)
+{
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = requirements.size;
+    allocInfo.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+
+    VkDeviceMemory memory;
+    auto res = vkAllocateMemory(logical, &allocInfo, nullptr, &memory);
+    if (res != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate device memory!");
+    }
+    memoryTracker->allocated(memory, allocInfo.allocationSize,
+                             allocInfo.memoryTypeIndex, category);
+    return memory;
+}
+
+void Device::freeMemory(VkDeviceMemory memory) {
+    memoryTracker->freed(memory);
+    vkFreeMemory(logical, memory, nullptr);
+}
+
 void Device::createSwapChain() {
     SwapChainSupportDetails swapChainSupport = querySwapChainSupport();
 }
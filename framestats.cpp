@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <iomanip>
+#include "vk.h"
+
+// Present intervals longer than this multiple of the running median are
+// counted as hitches, once enough frames have been seen to trust the median.
+static const double hitchFactor = 2.0;
+static const uint64_t hitchMinSamples = 30;
+
+static const char *metricNames[] = {"cpu frame", "acquire", "record", "submit", "present interval"};
+static const char *metricKeys[] = {"frame_cpu", "acquire", "record", "submit", "present_interval"};
+
+Histogram::Histogram()
+: buckets(64 << subBits)
+{
+}
+
+// Values below 2^subBits get one bucket each; above that, bucket
+// (shift + 1, top) covers values whose top subBits + 1 bits equal top.
+size_t Histogram::bucket(uint64_t value) {
+    const uint64_t sub = 1 << subBits;
+    if (value < sub) {
+        return value;
+    }
+    uint32_t msb = 63 - __builtin_clzll(value);
+    uint32_t shift = msb - subBits;
+    return (shift + 1) * sub + ((value >> shift) - sub);
+}
+
+uint64_t Histogram::bucketValue(size_t index) {
+    const uint64_t sub = 1 << subBits;
+    if (index < sub) {
+        return index;
+    }
+    uint32_t shift = index / sub - 1;
+    uint64_t top = index % sub + sub;
+    return ((top + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+    buckets[bucket(value)]++;
+    total++;
+    maxValue = std::max(maxValue, value);
+}
+
+void Histogram::merge(const Histogram& other) {
+    for (size_t i = 0; i < buckets.size(); i++) {
+        buckets[i] += other.buckets[i];
+    }
+    total += other.total;
+    maxValue = std::max(maxValue, other.maxValue);
+}
+
+void Histogram::clear() {
+    std::fill(buckets.begin(), buckets.end(), 0);
+    total = 0;
+    maxValue = 0;
+}
+
+uint64_t Histogram::percentile(double p) const {
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t) (p / 100.0 * total + 0.5);
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::min(bucketValue(i), maxValue);
+        }
+    }
+    return maxValue;
+}
+
+FrameStats::FrameStats(bool json, double reportSeconds)
+: machineReadable(json), reportSeconds(reportSeconds)
+{
+    window.start = total.start = frameStart = Clock::now();
+}
+
+void FrameStats::beginFrame() {
+    frameStart = Clock::now();
+}
+
+void FrameStats::record(Metric metric, Clock::time_point start) {
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+        Clock::now() - start).count();
+    window.metrics[metric].record(micros);
+    if (budgets[metric] && (uint64_t) micros > budgets[metric]) {
+        window.overBudget[metric]++;
+    }
+}
+
+// Samples above micros are counted and reported next to the metric's
+// percentiles. Zero disables the budget.
+void FrameStats::setBudget(Metric metric, uint64_t micros) {
+    budgets[metric] = micros;
+}
+
+void FrameStats::presented() {
+    auto now = Clock::now();
+    if (lastPresent != Clock::time_point()) {
+        uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+            now - lastPresent).count();
+        const Histogram& intervals = total.metrics[PRESENT_INTERVAL];
+        if (intervals.count() >= hitchMinSamples
+            && micros > hitchFactor * intervals.percentile(50)) {
+            window.hitches++;
+        }
+        window.metrics[PRESENT_INTERVAL].record(micros);
+    }
+    lastPresent = now;
+}
+
+// Returns true when a periodic report was written, so callers can append
+// their own sections to it.
+bool FrameStats::endFrame(std::ostream& out) {
+    record(FRAME_CPU, frameStart);
+
+    auto now = Clock::now();
+    if (std::chrono::duration<double>(now - window.start).count() < reportSeconds) {
+        return false;
+    }
+    report(out, window, "window");
+    mergeWindow();
+    window.start = now;
+    return true;
+}
+
+void FrameStats::mergeWindow() {
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        total.metrics[i].merge(window.metrics[i]);
+        window.metrics[i].clear();
+        total.overBudget[i] += window.overBudget[i];
+        window.overBudget[i] = 0;
+    }
+    for (const auto& entry : window.counters) {
+        Counter& counter = total.counters[entry.first];
+        counter.sum += entry.second.sum;
+        counter.samples += entry.second.samples;
+    }
+    window.counters.clear();
+    total.hitches += window.hitches;
+    window.hitches = 0;
+}
+
+void FrameStats::counter(const std::string& name, uint64_t value) {
+    Counter& counter = window.counters[name];
+    counter.sum += value;
+    counter.samples++;
+}
+
+void FrameStats::summary(std::ostream& out) {
+    mergeWindow();
+    report(out, total, "summary");
+}
+
+void FrameStats::report(std::ostream& out, const Window& stats, const char *type) {
+    double seconds = std::chrono::duration<double>(Clock::now() - stats.start).count();
+    uint64_t frames = stats.metrics[FRAME_CPU].count();
+    double fps = seconds > 0.0 ? frames / seconds : 0.0;
+
+    if (machineReadable) {
+        // One JSON object per line, durations in microseconds.
+        out << "{\"type\":\"" << type << "\",\"frames\":" << frames
+            << ",\"seconds\":" << seconds << ",\"fps\":" << fps
+            << ",\"hitches\":" << stats.hitches;
+        for (int i = 0; i < METRIC_COUNT; i++) {
+            const Histogram& h = stats.metrics[i];
+            out << ",\"" << metricKeys[i] << "\":{\"p50\":" << h.percentile(50)
+                << ",\"p95\":" << h.percentile(95) << ",\"p99\":" << h.percentile(99)
+                << ",\"max\":" << h.max();
+            if (budgets[i]) {
+                out << ",\"budget\":" << budgets[i] << ",\"over_budget\":" << stats.overBudget[i];
+            }
+            out << "}";
+        }
+        out << ",\"counters\":{";
+        for (auto it = stats.counters.begin(); it != stats.counters.end(); ++it) {
+            out << (it == stats.counters.begin() ? "" : ",") << "\"" << it->first << "\":"
+                << it->second.sum / it->second.samples;
+        }
+        out << "}}" << std::endl;
+        return;
+    }
+
+    out << std::fixed << std::setprecision(1)
+        << type << ": " << frames << " frames in " << seconds << " s, "
+        << fps << " FPS, " << stats.hitches << " hitches" << std::endl
+        << std::setprecision(3);
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        const Histogram& h = stats.metrics[i];
+        if (h.count() == 0) {
+            continue;
+        }
+        out << "  " << metricNames[i]
+            << ": p50 " << h.percentile(50) / 1000.0
+            << " p95 " << h.percentile(95) / 1000.0
+            << " p99 " << h.percentile(99) / 1000.0
+            << " max " << h.max() / 1000.0 << " ms";
+        if (budgets[i]) {
+            out << ", " << stats.overBudget[i] << " over " << budgets[i] / 1000.0 << " ms budget";
+        }
+        out << std::endl;
+    }
+    // Counters are averaged over the number of times they were sampled,
+    // i.e. per recorded scope rather than per frame.
+    for (const auto& entry : stats.counters) {
+        out << "  " << entry.first << ": "
+            << entry.second.sum / entry.second.samples << std::endl;
+    }
+    out << std::defaultfloat;
+}
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cstddef>
+#include "vk.h"
+
+bool GpuCulling::supported(Device& device) {
+    return device.features().multiDrawIndirect
+        && device.features().drawIndirectFirstInstance;
+}
+
+GpuCulling::GpuCulling(std::shared_ptr<Device> deviceptr, ShaderCache& shaders,
+                       LayoutCache& layouts, DescriptorAllocator& descriptors,
+                       uint32_t maxObjects)
+: deviceptr(deviceptr), device(*deviceptr.get()), maxObjects(maxObjects)
+{
+    if (device.hasExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+        drawIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)
+            vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
+    }
+
+    auto cullShader = shaders.load("shaders/cull.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+    uint32_t compact = drawIndirectCount ? 1 : 0;
+    pipeline.reset(new ComputePipeline(deviceptr, cullShader, layouts, compact));
+
+    createSharedBuffer(device, maxObjects * sizeof(ObjectData),
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                       MEMORY_OTHER, objectBuffer, objectMemory);
+    vkMapMemory(device, objectMemory, 0, VK_WHOLE_SIZE, 0, (void**) &mappedObjects);
+
+    createSharedBuffer(device, maxObjects * sizeof(VkDrawIndexedIndirectCommand),
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                       MEMORY_OTHER, commandBuffer, commandMemory);
+    createSharedBuffer(device, sizeof(uint32_t),
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+                       | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                       MEMORY_OTHER, countBuffer, countMemory);
+
+    // Set 0 of cull.comp, and set 1 of the scene pipeline for the vertex
+    // shader's object transforms.
+    const auto& cullLayout = layouts.pipelineLayout({&cullShader->reflection()});
+    auto sceneVert = shaders.load("shaders/scene.spv", VK_SHADER_STAGE_VERTEX_BIT);
+    auto sceneFrag = shaders.load("shaders/frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+    const auto& sceneLayout = layouts.pipelineLayout({&sceneVert->reflection(),
+                                              &sceneFrag->reflection()});
+    cullSet = descriptors.allocate(cullLayout.setLayouts[0]->layout);
+    drawSet = descriptors.allocate(sceneLayout.setLayouts[1]->layout);
+
+    VkDescriptorBufferInfo buffers[] = {
+        {objectBuffer, 0, VK_WHOLE_SIZE},
+        {commandBuffer, 0, VK_WHOLE_SIZE},
+        {countBuffer, 0, VK_WHOLE_SIZE},
+    };
+    VkWriteDescriptorSet writes[4] = {};
+    for (int i = 0; i < 4; i++) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].descriptorCount = 1;
+    }
+    for (int i = 0; i < 3; i++) {
+        writes[i].dstSet = cullSet;
+        writes[i].dstBinding = i;
+        writes[i].pBufferInfo = &buffers[i];
+    }
+    writes[3].dstSet = drawSet;
+    writes[3].dstBinding = 0;
+    writes[3].pBufferInfo = &buffers[0];
+    vkUpdateDescriptorSets(device, 4, writes, 0, nullptr);
+}
+
+GpuCulling::~GpuCulling() {
+    vkUnmapMemory(device, objectMemory);
+    vkDestroyBuffer(device, objectBuffer, nullptr);
+    vkDestroyBuffer(device, commandBuffer, nullptr);
+    vkDestroyBuffer(device, countBuffer, nullptr);
+    device.freeMemory(objectMemory);
+    device.freeMemory(commandMemory);
+    device.freeMemory(countMemory);
+}
+
+void GpuCulling::setObjectCount(uint32_t count) {
+    objectCount = std::min(count, maxObjects);
+}
+
+// Recorded on the compute queue; the semaphore from AsyncCompute makes the
+// commands visible to the indirect draw.
+void GpuCulling::cull(VkCommandBuffer cmd, const glm::mat4& viewProj, uint32_t indexCount) {
+    vkCmdFillBuffer(cmd, countBuffer, 0, sizeof(uint32_t), 0);
+
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+
+    CullConstants constants;
+    Frustum frustum = Frustum::fromMatrix(viewProj);
+    std::copy(frustum.planes, frustum.planes + 6, constants.planes);
+    constants.objectCount = objectCount;
+    constants.indexCount = indexCount;
+
+    VkPipelineLayout layout = *pipeline;
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, *pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &cullSet, 0, nullptr);
+    // The struct's tail padding is outside the shader's push constant range.
+    uint32_t size = offsetof(CullConstants, indexCount) + sizeof(uint32_t);
+    vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, size, &constants);
+    vkCmdDispatch(cmd, (objectCount + 63) / 64, 1, 1);
+}
+
+void GpuCulling::draw(VkCommandBuffer cmd, VkPipelineLayout layout) {
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1, 1, &drawSet, 0, nullptr);
+    if (drawIndirectCount) {
+        drawIndirectCount(cmd, commandBuffer, 0, countBuffer, 0, objectCount,
+                          sizeof(VkDrawIndexedIndirectCommand));
+    } else {
+        vkCmdDrawIndexedIndirect(cmd, commandBuffer, 0, objectCount,
+                                 sizeof(VkDrawIndexedIndirectCommand));
+    }
+}
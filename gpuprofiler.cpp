@@ -0,0 +1,124 @@
+#include <algorithm>
+#include "vk.h"
+
+// Number of samples each pass keeps for its rolling min/avg/max.
+static const size_t statsWindow = 128;
+
+GpuProfiler::GpuProfiler(std::shared_ptr<Device> deviceptr, uint32_t framesInFlight,
+                         uint32_t maxScopesPerFrame)
+: deviceptr(deviceptr), device(*deviceptr.get()), framesInFlight(framesInFlight),
+  maxScopes(maxScopesPerFrame), scopes(framesInFlight)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+    timestampPeriod = properties.limits.timestampPeriod;
+
+    // Scopes are recorded on the graphics queue, whose family decides how
+    // many low bits of each timestamp are meaningful.
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, families.data());
+    uint32_t validBits = families[deviceptr->queueFamilies().graphicsFamily].timestampValidBits;
+    if (timestampPeriod == 0.0 || validBits == 0) {
+        std::cout << "GPU timestamps unsupported, profiler disabled" << std::endl;
+        return;
+    }
+    timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+    VkQueryPoolCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    info.queryCount = framesInFlight * maxScopes * 2;
+
+    if (vkCreateQueryPool(device, &info, nullptr, &pool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create timestamp query pool!");
+    }
+}
+
+GpuProfiler::~GpuProfiler() {
+    if (pool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, pool, nullptr);
+    }
+}
+
+// Must be recorded outside a render pass: resolves the queries this slot
+// wrote framesInFlight frames ago, then resets them for reuse.
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+    if (pool == VK_NULL_HANDLE) {
+        return;
+    }
+    frame = frameIndex % framesInFlight;
+    collect(frame);
+    scopes[frame].clear();
+    vkCmdResetQueryPool(commandBuffer, pool, frame * maxScopes * 2, maxScopes * 2);
+}
+
+uint32_t GpuProfiler::begin(VkCommandBuffer commandBuffer, const char *name) {
+    auto& frameScopes = scopes[frame];
+    if (pool == VK_NULL_HANDLE || frameScopes.size() >= maxScopes) {
+        return UINT32_MAX;
+    }
+    uint32_t query = (frame * maxScopes + frameScopes.size()) * 2;
+    frameScopes.push_back({name, query});
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, pool, query);
+    return frameScopes.size() - 1;
+}
+
+void GpuProfiler::end(VkCommandBuffer commandBuffer, uint32_t scope) {
+    if (scope == UINT32_MAX) {
+        return;
+    }
+    uint32_t query = scopes[frame][scope].query + 1;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pool, query);
+}
+
+void GpuProfiler::collect(uint32_t frameIndex) {
+    const auto& frameScopes = scopes[frameIndex];
+    if (frameScopes.empty()) {
+        return;
+    }
+
+    uint32_t first = frameIndex * maxScopes * 2;
+    std::vector<uint64_t> timestamps(frameScopes.size() * 2);
+    auto res = vkGetQueryPoolResults(device, pool, first, timestamps.size(),
+                                     timestamps.size() * sizeof(uint64_t),
+                                     timestamps.data(), sizeof(uint64_t),
+                                     VK_QUERY_RESULT_64_BIT);
+    if (res != VK_SUCCESS) {
+        return;
+    }
+
+    for (size_t i = 0; i < frameScopes.size(); i++) {
+        // Bits above timestampValidBits are undefined; masked, the
+        // subtraction also stays correct across a counter wrap.
+        uint64_t ticks = ((timestamps[i * 2 + 1] & timestampMask)
+                          - (timestamps[i * 2] & timestampMask)) & timestampMask;
+        double ms = ticks * timestampPeriod / 1e6;
+        auto& pass = stats[frameScopes[i].name];
+        if (pass.samples.size() < statsWindow) {
+            pass.samples.push_back(ms);
+        } else {
+            pass.samples[pass.next] = ms;
+        }
+        pass.next = (pass.next + 1) % statsWindow;
+    }
+}
+
+void GpuProfiler::report(std::ostream& out) {
+    for (const auto& entry : stats) {
+        const auto& samples = entry.second.samples;
+        if (samples.empty()) {
+            continue;
+        }
+        double sum = 0.0;
+        for (double sample : samples) {
+            sum += sample;
+        }
+        out << "gpu " << entry.first
+            << ": min " << *std::min_element(samples.begin(), samples.end())
+            << " ms, avg " << sum / samples.size()
+            << " ms, max " << *std::max_element(samples.begin(), samples.end())
+            << " ms" << std::endl;
+    }
+}
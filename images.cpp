@@ -5,7 +5,7 @@
 
 Image::Image(uint32_t width, uint32_t height, std::shared_ptr<VkDevice> deviceptr,
              VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
-             VkMemoryPropertyFlags properties)
+             VkMemoryPropertyFlags properties, MemoryCategory category)
 : deviceptr(deviceptr), device(*deviceptr.get()), format(format)
 {
     VkImageCreateInfo imageInfo = {};
@@ -30,16 +30,7 @@ Image::Image(uint32_t width, uint32_t height, std::shared_ptr<VkDevice> devicept
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = device.findMemoryType(memRequirements.memoryTypeBits,
-                                                      properties);
-
-    auto res = vkAllocateMemory(device, &allocInfo, nullptr, &memory);
-    if (res != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
-    }
+    memory = device.allocateMemory(memRequirements, properties, category);
     vkBindImageMemory(device, image, memory, 0);
 }
 
@@ -61,7 +52,7 @@ void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayo
 
 
 Image::~Image() {
-    vkFreeMemory(*deviceptr.get(), memory);
+    device.freeMemory(memory);
     vkDestroyImage(image);
 }
 
@@ -2,11 +2,21 @@
 
 Instance::Instance(const std::string& name, GLFWwindow *window) {
     createInstance(name);
-    setupDebugCallback()
+    debug::load(_instance);
+#ifndef NDEBUG
+    setupDebugMessenger();
+#endif
     createSurface(window);
 }
 
 Instance::~Instance() {
+#ifndef NDEBUG
+    if (messenger != VK_NULL_HANDLE) {
+        auto destroy = (PFN_vkDestroyDebugUtilsMessengerEXT)
+            vkGetInstanceProcAddr(_instance, "vkDestroyDebugUtilsMessengerEXT");
+        destroy(_instance, messenger, nullptr);
+    }
+#endif
     vkDestroySurfaceKHR(_instance, _surface, nullptr);
     vkDestroyInstance(_instance);
 }
@@ -25,17 +35,29 @@ void Instance::createInstance(const std::string& name) {
     createInfo.pApplicationInfo = &appInfo;
 
 
+    const DebugConfig& config = DebugConfig::get();
     checkExtensions();
-    if (enableValidationLayers) {
+    if (config.validationEnabled()) {
         checkValidationLayers();
     }
 
     auto extensions = getRequiredExtensions();
-    if (enableValidationLayers) {
-        createInfo.enabledLayerCount = validationLayers.size();
-        createInfo.ppEnabledLayerNames = validationLayers.data();
-    } else {
-        createInfo.enabledLayerCount = 0;
+    createInfo.enabledLayerCount = config.layers().size();
+    createInfo.ppEnabledLayerNames = config.layers().data();
+
+    // Synchronization and best-practices checks are opt-in layer features.
+    std::vector<VkValidationFeatureEnableEXT> enables;
+    if (config.validation == VALIDATION_SYNC) {
+        enables.push_back(VK_VALIDATION_FEATURE_ENABLE_SYNCHRONIZATION_VALIDATION_EXT);
+    } else if (config.validation == VALIDATION_BEST_PRACTICES) {
+        enables.push_back(VK_VALIDATION_FEATURE_ENABLE_BEST_PRACTICES_EXT);
+    }
+    VkValidationFeaturesEXT features = {};
+    features.sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT;
+    features.enabledValidationFeatureCount = enables.size();
+    features.pEnabledValidationFeatures = enables.data();
+    if (!enables.empty()) {
+        createInfo.pNext = &features;
     }
     createInfo.enabledExtensionCount = extensions.size();
     createInfo.ppEnabledExtensionNames = extensions.data();
@@ -57,8 +79,25 @@ std::vector<const char*> Instance::getRequiredExtensions() {
         extensions.push_back(glfwExtensions[i]);
     }
 
-    if (enableValidationLayers) {
-        extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+    const DebugConfig& config = DebugConfig::get();
+    if (config.validationEnabled()) {
+        extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+    }
+    if (config.validation >= VALIDATION_SYNC) {
+        extensions.push_back(VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME);
+    }
+
+    // Optional: needed to query VK_EXT_memory_budget.
+    uint32_t count = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
+    std::vector<VkExtensionProperties> available(count);
+    vkEnumerateInstanceExtensionProperties(nullptr, &count, available.data());
+    for (const auto& extension : available) {
+        if (strcmp(extension.extensionName,
+                   VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+            extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+            break;
+        }
     }
 
     return extensions;
@@ -88,7 +127,7 @@ void Instance::checkValidationLayers() {
         std::cout << "\t" << layer.layerName << std::endl;
     }
 
-    for (const char *layerName : validationLayers) {
+    for (const char *layerName : DebugConfig::get().layers()) {
         bool found = false;
         for (const auto& layer : layers) {
             if (strcmp(layerName, layer.layerName) == 0) {
@@ -103,58 +142,41 @@ void Instance::checkValidationLayers() {
     }
 }
 
-VkResult Instance::CreateDebugReportCallbackEXT(
-        const VkDebugReportCallbackCreateInfoEXT* pCreateInfo,
-        const VkAllocationCallbacks* pAllocator,
-        VkDebugReportCallbackEXT* pCallback)
-{
-    auto func = (PFN_vkCreateDebugReportCallbackEXT) vkGetInstanceProcAddr(_instance, "vkCreateDebugReportCallbackEXT");
-    if (func != nullptr) {
-        return func(_instance, pCreateInfo, pAllocator, pCallback);
-    } else {
-        return VK_ERROR_EXTENSION_NOT_PRESENT;
-    }
-}
-
-void Instance::DestroyDebugReportCallbackEXT(
-        VkDebugReportCallbackEXT callback,
-        const VkAllocationCallbacks* pAllocator)
-{
-    auto func = (PFN_vkDestroyDebugReportCallbackEXT) vkGetInstanceProcAddr(_instance, "vkDestroyDebugReportCallbackEXT");
-    if (func != nullptr) {
-        func(_instance, callback, pAllocator);
-    }
-}
-
-static VKAPI_ATTR VkBool32 VKAPI_CALL Instance::debugCallback(
-        VkDebugReportFlagsEXT flags,
-        VkDebugReportObjectTypeEXT objType,
-        uint64_t obj,
-        size_t location,
-        int32_t code,
-        const char* layerPrefix,
-        const char* msg,
+#ifndef NDEBUG
+VKAPI_ATTR VkBool32 VKAPI_CALL Instance::debugCallback(
+        VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+        VkDebugUtilsMessageTypeFlagsEXT types,
+        const VkDebugUtilsMessengerCallbackDataEXT* data,
         void* userData) {
 
-    std::cerr << "validation layer: " << msg << std::endl;
+    std::cerr << "validation layer: " << data->pMessage << std::endl;
 
     return VK_FALSE;
 }
 
-void Instance::setupDebugCallback() {
-    if (enableValidationLayers) {
-        VkDebugReportCallbackCreateInfoEXT createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
-        createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
-        createInfo.pfnCallback = debugCallback;
+void Instance::setupDebugMessenger() {
+    const DebugConfig& config = DebugConfig::get();
+    if (!config.validationEnabled()) {
+        return;
+    }
 
-        auto res = CreateDebugReportCallbackEXT(&createInfo, nullptr, _reportCallback);
-        if (res != VK_SUCCESS) {
-            throw std::runtime_error("failed to set up debug callback!");
-        }
+    VkDebugUtilsMessengerCreateInfoEXT createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+    createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT
+        | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+    createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT;
+    if (config.validation >= VALIDATION_SYNC) {
+        createInfo.messageType |= VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+    }
+    createInfo.pfnUserCallback = debugCallback;
 
+    auto create = (PFN_vkCreateDebugUtilsMessengerEXT)
+        vkGetInstanceProcAddr(_instance, "vkCreateDebugUtilsMessengerEXT");
+    if (!create || create(_instance, &createInfo, nullptr, &messenger) != VK_SUCCESS) {
+        throw std::runtime_error("failed to set up debug messenger!");
     }
 }
+#endif
 
 void Instance::createSurface(GLFWwindow *window) {
     auto res = glfwCreateWindowSurface(instance, window, nullptr, &_surface);
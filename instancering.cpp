@@ -0,0 +1,47 @@
+#include "vk.h"
+
+InstanceRing::InstanceRing(std::shared_ptr<Device> deviceptr, uint32_t framesInFlight,
+                           uint32_t capacity)
+: deviceptr(deviceptr), device(*deviceptr.get()),
+  framesInFlight(framesInFlight), instancesPerFrame(capacity)
+{
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = (VkDeviceSize) framesInFlight * capacity * sizeof(InstanceData);
+    bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create instance buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+    memory = device.allocateMemory(memRequirements,
+                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                   MEMORY_VERTEX);
+    vkBindBufferMemory(device, buffer, memory, 0);
+    vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, (void**) &mapped);
+    debug::setName(device, VK_OBJECT_TYPE_BUFFER, (uint64_t) buffer, "instances");
+}
+
+InstanceRing::~InstanceRing() {
+    vkUnmapMemory(device, memory);
+    vkDestroyBuffer(device, buffer, nullptr);
+    device.freeMemory(memory);
+}
+
+// The caller must know the GPU is done with frameIndex's previous contents,
+// i.e. the frame's command buffer is no longer pending.
+InstanceData *InstanceRing::begin(uint32_t frameIndex) {
+    return mapped + (size_t) (frameIndex % framesInFlight) * instancesPerFrame;
+}
+
+VkDeviceSize InstanceRing::offset(uint32_t frameIndex) const {
+    return (VkDeviceSize) (frameIndex % framesInFlight) * instancesPerFrame * sizeof(InstanceData);
+}
+
+void InstanceRing::bind(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+    VkDeviceSize regionOffset = offset(frameIndex);
+    vkCmdBindVertexBuffers(commandBuffer, 1, 1, &buffer, &regionOffset);
+}
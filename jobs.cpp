@@ -0,0 +1,346 @@
+#include <algorithm>
+#include <cstdlib>
+#include "jobs.h"
+#include "trace.h"
+
+struct JobSystem::Job {
+    std::function<void()> function;
+    // The job itself plus unfinished children.
+    std::atomic<int32_t> unfinished{1};
+    // Unfinished jobs it depends on, plus one until run() is called.
+    std::atomic<int32_t> dependencies{1};
+    std::atomic<bool> finished{false};
+    Handle parent;
+    // Set by run() so a scheduled job outlives its callers' handles.
+    Handle self;
+
+    std::mutex mutex;
+    std::vector<Handle> continuations;
+    std::exception_ptr error;
+};
+
+// Chase-Lev deque with a fixed capacity, in the C11 formulation of Le et
+// al., "Correct and Efficient Work-Stealing for Weak Memory Models". Only
+// the owning worker calls push() and pop(); any thread may steal().
+class JobSystem::Deque {
+public:
+    bool push(Job *job) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        if (b - t >= (int64_t) capacity) {
+            return false;
+        }
+        slots[b & (capacity - 1)].store(job, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    Job *pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        Job *job = slots[b & (capacity - 1)].load(std::memory_order_relaxed);
+        if (t == b) {
+            // Last item: race the thieves for it.
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                             std::memory_order_relaxed)) {
+                job = nullptr;
+            }
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    Job *steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        Job *job = slots[t & (capacity - 1)].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return job;
+    }
+
+private:
+    static const size_t capacity = 4096;
+    std::atomic<int64_t> top{0};
+    std::atomic<int64_t> bottom{0};
+    std::atomic<Job*> slots[capacity] = {};
+};
+
+struct JobSystem::Worker {
+    Deque deque;
+    std::thread thread;
+    uint32_t index;
+};
+
+thread_local JobSystem::Worker *JobSystem::currentWorker = nullptr;
+thread_local JobSystem *JobSystem::currentSystem = nullptr;
+
+JobSystem::JobSystem(unsigned workerCount)
+: mainThread(std::this_thread::get_id())
+{
+    for (unsigned i = 0; i < workerCount; i++) {
+        workers.emplace_back(new Worker());
+        workers.back()->index = i;
+    }
+    // Started only once every deque exists, since workers steal from all.
+    for (auto& worker : workers) {
+        worker->thread = std::thread(&JobSystem::work, this, worker.get());
+    }
+}
+
+// Jobs still queued are dropped; callers wait for their work first.
+JobSystem::~JobSystem() {
+    stopping = true;
+    wakeAll();
+    for (auto& worker : workers) {
+        worker->thread.join();
+    }
+}
+
+JobSystem& JobSystem::get() {
+    static JobSystem system([] {
+        if (const char *threads = getenv("VK_JOB_THREADS")) {
+            return (unsigned) strtoul(threads, nullptr, 10);
+        }
+        return std::max(1u, std::thread::hardware_concurrency()) - 1;
+    }());
+    return system;
+}
+
+JobSystem::Handle JobSystem::create(std::function<void()> function, const Handle& parent) {
+    Handle job = std::make_shared<Job>();
+    job->function = std::move(function);
+    if (parent) {
+        parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+        job->parent = parent;
+    }
+    return job;
+}
+
+void JobSystem::depend(const Handle& job, const Handle& before) {
+    std::lock_guard<std::mutex> lock(before->mutex);
+    if (!before->finished.load(std::memory_order_relaxed)) {
+        job->dependencies.fetch_add(1, std::memory_order_relaxed);
+        before->continuations.push_back(job);
+    }
+}
+
+void JobSystem::run(const Handle& job) {
+    job->self = job;
+    if (job->dependencies.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        schedule(job.get());
+    }
+}
+
+JobSystem::Handle JobSystem::spawn(std::function<void()> function) {
+    Handle job = create(std::move(function));
+    run(job);
+    return job;
+}
+
+void JobSystem::schedule(Job *job) {
+    if (!currentWorker || currentSystem != this || !currentWorker->deque.push(job)) {
+        std::lock_guard<std::mutex> lock(injectMutex);
+        injected.push_back(job);
+        injectedCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    queued.fetch_add(1, std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_seq_cst)) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wake.notify_one();
+    }
+}
+
+// Own deque first for locality, then the injection queue, then steal,
+// starting after the caller so thieves spread across victims.
+JobSystem::Job *JobSystem::take(Worker *self) {
+    Job *job = nullptr;
+    if (self) {
+        job = self->deque.pop();
+    }
+    if (!job && injectedCount.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(injectMutex);
+        if (!injected.empty()) {
+            job = injected.front();
+            injected.pop_front();
+            injectedCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+    size_t start = self ? self->index + 1 : 0;
+    for (size_t i = 0; !job && i < workers.size(); i++) {
+        Worker *victim = workers[(start + i) % workers.size()].get();
+        if (victim != self) {
+            job = victim->deque.steal();
+        }
+    }
+    if (job) {
+        queued.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+void JobSystem::execute(Job *job) {
+    try {
+        job->function();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        if (!job->error) {
+            job->error = std::current_exception();
+        }
+    }
+    finish(job);
+}
+
+// Called once for the job itself and once per child. The last call
+// releases continuations, passes errors up and finishes the parent.
+void JobSystem::finish(Job *job) {
+    if (job->unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    std::vector<Handle> next;
+    Handle self;
+    Handle parent = std::move(job->parent);
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        next.swap(job->continuations);
+        self = std::move(job->self);
+        job->function = nullptr;
+        if (job->error && parent) {
+            std::lock_guard<std::mutex> parentLock(parent->mutex);
+            if (!parent->error) {
+                parent->error = job->error;
+            }
+        }
+        job->finished.store(true, std::memory_order_seq_cst);
+    }
+    if (sleepers.load(std::memory_order_seq_cst)) {
+        wakeAll();
+    }
+
+    for (auto& continuation : next) {
+        if (continuation->dependencies.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            schedule(continuation.get());
+        }
+    }
+    if (parent) {
+        finish(parent.get());
+    }
+}
+
+void JobSystem::wakeAll() {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    wake.notify_all();
+}
+
+void JobSystem::wait(const Handle& job) {
+    TRACE_SCOPE("wait job");
+    Worker *self = currentSystem == this ? currentWorker : nullptr;
+    bool main = isMainThread();
+    while (!job->finished.load(std::memory_order_acquire)) {
+        if (main && mainPending.load(std::memory_order_relaxed)) {
+            pumpMainThread();
+            continue;
+        }
+        if (Job *next = take(self)) {
+            execute(next);
+            continue;
+        }
+        // Sleepers are counted before the checks, so finish(), schedule()
+        // and runOnMainThread() either see them and notify, or made their
+        // change visible to the predicate first.
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepers.fetch_add(1, std::memory_order_seq_cst);
+        wake.wait(lock, [&] {
+            return job->finished.load(std::memory_order_seq_cst)
+                || queued.load(std::memory_order_seq_cst)
+                || (main && mainPending.load(std::memory_order_seq_cst));
+        });
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    std::lock_guard<std::mutex> lock(job->mutex);
+    if (job->error) {
+        std::rethrow_exception(job->error);
+    }
+}
+
+void JobSystem::parallelFor(size_t count, size_t grain,
+                            const std::function<void(size_t, size_t)>& body)
+{
+    grain = std::max<size_t>(grain, 1);
+    if (count <= grain || workers.empty()) {
+        if (count) {
+            body(0, count);
+        }
+        return;
+    }
+
+    Handle root = create([] {});
+    for (size_t begin = 0; begin < count; begin += grain) {
+        size_t end = std::min(count, begin + grain);
+        run(create([&body, begin, end] { body(begin, end); }, root));
+    }
+    run(root);
+    wait(root);
+}
+
+std::future<void> JobSystem::runOnMainThread(std::function<void()> function) {
+    std::packaged_task<void()> task(std::move(function));
+    std::future<void> future = task.get_future();
+    if (isMainThread()) {
+        task();
+        return future;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mainMutex);
+        mainQueue.push_back(std::move(task));
+    }
+    mainPending.fetch_add(1, std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_seq_cst)) {
+        wakeAll();
+    }
+    return future;
+}
+
+void JobSystem::pumpMainThread() {
+    std::deque<std::packaged_task<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(mainMutex);
+        tasks.swap(mainQueue);
+    }
+    mainPending.fetch_sub(tasks.size(), std::memory_order_relaxed);
+    for (auto& task : tasks) {
+        task();
+    }
+}
+
+void JobSystem::work(Worker *self) {
+    currentWorker = self;
+    currentSystem = this;
+    while (!stopping.load(std::memory_order_relaxed)) {
+        if (Job *job = take(self)) {
+            execute(job);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepers.fetch_add(1, std::memory_order_seq_cst);
+        wake.wait(lock, [this] {
+            return stopping.load(std::memory_order_seq_cst) || queued.load(std::memory_order_seq_cst);
+        });
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
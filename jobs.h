@@ -0,0 +1,100 @@
+#ifndef __JOBS_H_INCLUDED
+#define __JOBS_H_INCLUDED
+
+// Work-stealing job scheduler shared by asset loading and rendering.
+//
+// Each worker owns a Chase-Lev deque: it pushes and pops at the bottom,
+// idle workers steal from the top. Jobs created by threads that are not
+// workers go through a shared injection queue. There are no fibers; a
+// thread waiting on a job runs other jobs until it finishes, and ordering
+// is expressed with parents (a job is finished once it and all its
+// children are) and continuations (a job runs once all jobs it depends on
+// have finished). Work that must stay on the main thread, such as GLFW
+// calls, is queued with runOnMainThread and run by pumpMainThread.
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem {
+public:
+    struct Job;
+    typedef std::shared_ptr<Job> Handle;
+
+    // The constructing thread becomes the main thread.
+    JobSystem(unsigned workers);
+    ~JobSystem();
+    // Process-wide instance with VK_JOB_THREADS workers, or one per core
+    // besides the main thread. The first call must come from the main
+    // thread.
+    static JobSystem& get();
+
+    unsigned workerCount() const { return workers.size(); }
+    bool isMainThread() const { return std::this_thread::get_id() == mainThread; }
+
+    // A created job does nothing until run(). With a parent, the parent is
+    // not finished until this job is; create children before the parent
+    // finishes, typically from inside it.
+    Handle create(std::function<void()> function, const Handle& parent = nullptr);
+    // job runs only after before has finished. Must precede run(job).
+    void depend(const Handle& job, const Handle& before);
+    void run(const Handle& job);
+    Handle spawn(std::function<void()> function);
+    // Runs other jobs until job and its children have finished, then
+    // rethrows the first exception any of them threw.
+    void wait(const Handle& job);
+
+    // Calls body(begin, end) over [0, count) in chunks of at most grain
+    // items, on the calling thread and the workers, and returns when all
+    // chunks are done.
+    void parallelFor(size_t count, size_t grain,
+                     const std::function<void(size_t, size_t)>& body);
+
+    std::future<void> runOnMainThread(std::function<void()> function);
+    // Runs the queued main-thread work. Call once per frame from the main
+    // thread; wait() on the main thread also calls it.
+    void pumpMainThread();
+
+private:
+    class Deque;
+    struct Worker;
+
+    std::thread::id mainThread;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<bool> stopping{false};
+
+    std::mutex injectMutex;
+    std::deque<Job*> injected;
+    std::atomic<size_t> injectedCount{0};
+
+    std::mutex mainMutex;
+    std::deque<std::packaged_task<void()>> mainQueue;
+    std::atomic<size_t> mainPending{0};
+
+    // Jobs scheduled but not yet taken; idle threads sleep until it is
+    // non-zero or something they wait on changes.
+    std::atomic<size_t> queued{0};
+    std::atomic<unsigned> sleepers{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+
+    // The worker the current thread runs, if any, and its system.
+    static thread_local Worker *currentWorker;
+    static thread_local JobSystem *currentSystem;
+
+    void schedule(Job *job);
+    Job *take(Worker *self);
+    void execute(Job *job);
+    void finish(Job *job);
+    void wakeAll();
+    void work(Worker *self);
+};
+
+#endif
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include "vk.h"
+
+LayoutCache::LayoutCache(std::shared_ptr<Device> deviceptr)
+: deviceptr(deviceptr), device(*deviceptr.get())
+{
+}
+
+LayoutCache::~LayoutCache() {
+    for (const auto& entry : pipelineLayouts) {
+        vkDestroyPipelineLayout(device, entry.second.layout, nullptr);
+    }
+    for (const auto& entry : setLayouts) {
+        vkDestroyDescriptorSetLayout(device, entry.second.layout, nullptr);
+    }
+}
+
+const DescriptorSetLayoutInfo& LayoutCache::setLayout(
+    std::vector<VkDescriptorSetLayoutBinding> bindings)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    std::sort(bindings.begin(), bindings.end(),
+              [](const VkDescriptorSetLayoutBinding& a,
+                 const VkDescriptorSetLayoutBinding& b) {
+                  return a.binding < b.binding;
+              });
+
+    std::vector<uint32_t> key;
+    for (const auto& binding : bindings) {
+        key.push_back(binding.binding);
+        key.push_back(binding.descriptorType);
+        key.push_back(binding.descriptorCount);
+        key.push_back(binding.stageFlags);
+    }
+
+    auto it = setLayouts.find(key);
+    if (it != setLayouts.end()) {
+        return it->second;
+    }
+
+    VkDescriptorSetLayoutCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    info.bindingCount = bindings.size();
+    info.pBindings = bindings.data();
+
+    DescriptorSetLayoutInfo layout;
+    layout.bindings = bindings;
+    if (vkCreateDescriptorSetLayout(device, &info, nullptr, &layout.layout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor set layout!");
+    }
+    return setLayouts.emplace(key, layout).first->second;
+}
+
+const PipelineLayoutInfo& LayoutCache::pipelineLayout(
+    const std::vector<const ShaderReflection*>& stages)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    std::map<uint32_t, std::map<uint32_t, VkDescriptorSetLayoutBinding>> sets;
+    std::vector<VkPushConstantRange> pushConstants;
+
+    for (const auto *stage : stages) {
+        for (const auto& reflected : stage->bindings) {
+            auto& bindings = sets[reflected.set];
+            auto it = bindings.find(reflected.binding.binding);
+            if (it == bindings.end()) {
+                bindings[reflected.binding.binding] = reflected.binding;
+                continue;
+            }
+            if (it->second.descriptorType != reflected.binding.descriptorType
+                || it->second.descriptorCount != reflected.binding.descriptorCount) {
+                throw std::runtime_error("shader stages disagree on descriptor binding!");
+            }
+            it->second.stageFlags |= reflected.binding.stageFlags;
+        }
+
+        for (const auto& range : stage->pushConstants) {
+            bool merged = false;
+            for (auto& existing : pushConstants) {
+                if (existing.offset == range.offset && existing.size == range.size) {
+                    existing.stageFlags |= range.stageFlags;
+                    merged = true;
+                }
+            }
+            if (!merged) {
+                pushConstants.push_back(range);
+            }
+        }
+    }
+
+    // Set indices must be contiguous in a pipeline layout; holes get an
+    // empty layout.
+    uint32_t setCount = sets.empty() ? 0 : sets.rbegin()->first + 1;
+    std::vector<const DescriptorSetLayoutInfo*> layouts;
+    std::vector<uint64_t> key;
+    for (uint32_t set = 0; set < setCount; set++) {
+        std::vector<VkDescriptorSetLayoutBinding> bindings;
+        for (const auto& entry : sets[set]) {
+            bindings.push_back(entry.second);
+        }
+        const DescriptorSetLayoutInfo& info = setLayout(bindings);
+        layouts.push_back(&info);
+        key.push_back((uint64_t) info.layout);
+    }
+    for (const auto& range : pushConstants) {
+        key.push_back(((uint64_t) range.offset << 32) | range.size);
+        key.push_back(range.stageFlags);
+    }
+
+    auto it = pipelineLayouts.find(key);
+    if (it != pipelineLayouts.end()) {
+        return it->second;
+    }
+
+    std::vector<VkDescriptorSetLayout> handles;
+    for (const auto *layout : layouts) {
+        handles.push_back(layout->layout);
+    }
+
+    VkPipelineLayoutCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    info.setLayoutCount = handles.size();
+    info.pSetLayouts = handles.data();
+    info.pushConstantRangeCount = pushConstants.size();
+    info.pPushConstantRanges = pushConstants.data();
+
+    PipelineLayoutInfo layout;
+    layout.setLayouts = layouts;
+    layout.pushConstants = pushConstants;
+    if (vkCreatePipelineLayout(device, &info, nullptr, &layout.layout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+    return pipelineLayouts.emplace(key, layout).first->second;
+}
@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
+#include "vk.h"
+
+// Garland-Heckbert quadric: the symmetric 4x4 matrix sum of squared plane
+// distances, stored as its upper triangle.
+struct Quadric {
+    double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+    double a11 = 0, a12 = 0, a13 = 0;
+    double a22 = 0, a23 = 0;
+    double a33 = 0;
+
+    void addPlane(const glm::dvec3& n, double d) {
+        a00 += n.x * n.x; a01 += n.x * n.y; a02 += n.x * n.z; a03 += n.x * d;
+        a11 += n.y * n.y; a12 += n.y * n.z; a13 += n.y * d;
+        a22 += n.z * n.z; a23 += n.z * d;
+        a33 += d * d;
+    }
+
+    Quadric& operator+=(const Quadric& q) {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+        a11 += q.a11; a12 += q.a12; a13 += q.a13;
+        a22 += q.a22; a23 += q.a23;
+        a33 += q.a33;
+        return *this;
+    }
+
+    double error(const glm::vec3& p) const {
+        double x = p.x, y = p.y, z = p.z;
+        return a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+             + a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+             + a22 * z * z + 2 * a23 * z
+             + a33;
+    }
+};
+
+struct Collapse {
+    uint32_t from;
+    uint32_t to;
+    double cost;
+};
+
+static glm::vec3 triangleNormal(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    return glm::cross(b - a, c - a);
+}
+
+static uint64_t edgeKey(uint32_t a, uint32_t b) {
+    return ((uint64_t) a << 32) | b;
+}
+
+// Edge-collapse simplification that only moves vertices onto existing
+// vertices, so every level can index the original vertex array. Vertices on
+// open borders (including UV seams, which dedup leaves as separate vertices)
+// never move. Returns at most targetIndexCount indices when the mesh allows;
+// *error receives the largest collapse error as a distance in model units.
+std::vector<uint32_t> simplifyMesh(const std::vector<Vertex>& vertices,
+                                   const std::vector<uint32_t>& indices,
+                                   size_t targetIndexCount, float *error)
+{
+    std::vector<uint32_t> result = indices;
+    std::vector<Quadric> quadrics(vertices.size());
+    std::vector<bool> border(vertices.size(), false);
+
+    std::unordered_set<uint64_t> edges;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        for (int e = 0; e < 3; e++) {
+            edges.insert(edgeKey(indices[i + e], indices[i + (e + 1) % 3]));
+        }
+
+        const glm::vec3& a = vertices[indices[i]].pos;
+        const glm::vec3& b = vertices[indices[i + 1]].pos;
+        const glm::vec3& c = vertices[indices[i + 2]].pos;
+        glm::dvec3 normal(triangleNormal(a, b, c));
+        double length = glm::length(normal);
+        if (length == 0.0) {
+            continue;
+        }
+        normal /= length;
+        Quadric plane;
+        plane.addPlane(normal, -glm::dot(normal, glm::dvec3(a)));
+        for (int v = 0; v < 3; v++) {
+            quadrics[indices[i + v]] += plane;
+        }
+    }
+    for (uint64_t key : edges) {
+        uint32_t a = key >> 32;
+        uint32_t b = key & 0xffffffff;
+        if (!edges.count(edgeKey(b, a))) {
+            border[a] = border[b] = true;
+        }
+    }
+
+    double maxCost = 0.0;
+    std::vector<uint32_t> remap(vertices.size());
+    std::vector<bool> locked(vertices.size());
+    std::vector<uint32_t> triangleStart(vertices.size() + 1);
+    std::vector<uint32_t> triangles;
+    std::vector<Collapse> collapses;
+
+    while (result.size() > targetIndexCount) {
+        // Vertex to triangle adjacency for the flip test.
+        std::fill(triangleStart.begin(), triangleStart.end(), 0);
+        for (uint32_t index : result) {
+            triangleStart[index + 1]++;
+        }
+        for (size_t v = 0; v < vertices.size(); v++) {
+            triangleStart[v + 1] += triangleStart[v];
+        }
+        triangles.resize(result.size());
+        std::vector<uint32_t> cursor(triangleStart.begin(), triangleStart.end() - 1);
+        for (size_t i = 0; i < result.size(); i++) {
+            triangles[cursor[result[i]]++] = i / 3;
+        }
+
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3) {
+            for (int e = 0; e < 3; e++) {
+                uint32_t a = result[i + e];
+                uint32_t b = result[i + (e + 1) % 3];
+                if (!border[a]) {
+                    Quadric q = quadrics[a];
+                    q += quadrics[b];
+                    collapses.push_back({a, b, q.error(vertices[b].pos)});
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+        for (size_t v = 0; v < vertices.size(); v++) {
+            remap[v] = v;
+        }
+        std::fill(locked.begin(), locked.end(), false);
+
+        size_t triangleCount = result.size() / 3;
+        size_t targetTriangles = targetIndexCount / 3;
+        size_t performed = 0;
+        for (const Collapse& collapse : collapses) {
+            if (triangleCount <= targetTriangles) {
+                break;
+            }
+            if (locked[collapse.from] || locked[collapse.to]) {
+                continue;
+            }
+
+            // Reject collapses that would flip a neighbouring triangle.
+            bool flips = false;
+            size_t removed = 0;
+            for (uint32_t t = triangleStart[collapse.from]; t < triangleStart[collapse.from + 1]; t++) {
+                const uint32_t *tri = &result[triangles[t] * 3];
+                if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) {
+                    removed++;
+                    continue;
+                }
+                glm::vec3 before[3], after[3];
+                for (int k = 0; k < 3; k++) {
+                    before[k] = vertices[tri[k]].pos;
+                    after[k] = tri[k] == collapse.from ? vertices[collapse.to].pos : before[k];
+                }
+                glm::vec3 n0 = triangleNormal(before[0], before[1], before[2]);
+                glm::vec3 n1 = triangleNormal(after[0], after[1], after[2]);
+                if (glm::dot(n0, n1) <= 0.0f) {
+                    flips = true;
+                    break;
+                }
+            }
+            if (flips) {
+                continue;
+            }
+
+            // The one-ring is locked for the rest of the pass, so the
+            // adjacency and positions used above stay valid.
+            for (uint32_t t = triangleStart[collapse.from]; t < triangleStart[collapse.from + 1]; t++) {
+                const uint32_t *tri = &result[triangles[t] * 3];
+                locked[tri[0]] = locked[tri[1]] = locked[tri[2]] = true;
+            }
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to] += quadrics[collapse.from];
+            maxCost = std::max(maxCost, collapse.cost);
+            triangleCount -= removed;
+            performed++;
+        }
+        if (performed == 0) {
+            break;
+        }
+
+        size_t write = 0;
+        for (size_t i = 0; i < result.size(); i += 3) {
+            uint32_t a = remap[result[i]];
+            uint32_t b = remap[result[i + 1]];
+            uint32_t c = remap[result[i + 2]];
+            if (a != b && b != c && c != a) {
+                result[write++] = a;
+                result[write++] = b;
+                result[write++] = c;
+            }
+        }
+        result.resize(write);
+    }
+
+    if (error) {
+        *error = (float) std::sqrt(maxCost);
+    }
+    return result;
+}
+
+// Appends up to levels - 1 simplified index lists to indices, each aiming
+// for half the triangles of the one before. Level 0 is the original range.
+// Each level is simplified from the previous one, which is much cheaper
+// than starting over from the full mesh, and errors are summed so they stay
+// an upper bound. Stops early once a level no longer shrinks meaningfully.
+std::vector<MeshLod> buildLods(const std::vector<Vertex>& vertices,
+                               std::vector<uint32_t>& indices, uint32_t levels)
+{
+    TRACE_SCOPE("build lods");
+    std::vector<MeshLod> lods;
+    uint32_t baseCount = indices.size();
+    lods.push_back({0, baseCount, 0.0f});
+
+    std::vector<uint32_t> source(indices.begin(), indices.end());
+    for (uint32_t level = 1; level < levels; level++) {
+        size_t target = (baseCount >> level) / 3 * 3;
+        float error;
+        auto simplified = simplifyMesh(vertices, source, target, &error);
+        if (simplified.empty() || simplified.size() > lods.back().indexCount * 9 / 10) {
+            break;
+        }
+        error += lods.back().error;
+        lods.push_back({(uint32_t) indices.size(), (uint32_t) simplified.size(), error});
+        indices.insert(indices.end(), simplified.begin(), simplified.end());
+        source.swap(simplified);
+    }
+    return lods;
+}
+
+// Coarsest level whose error, projected to the screen at distance, stays
+// under maxPixels. pixelsPerUnit is the projected size of one model unit at
+// distance 1, i.e. viewport height * proj[1][1] / 2.
+uint32_t selectLod(const std::vector<MeshLod>& lods, float distance,
+                   float pixelsPerUnit, float maxPixels)
+{
+    distance = std::max(distance, 1e-3f);
+    uint32_t level = 0;
+    for (uint32_t i = 1; i < lods.size(); i++) {
+        if (lods[i].error * pixelsPerUnit / distance > maxPixels) {
+            break;
+        }
+        level = i;
+    }
+    return level;
+}
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include "vk.h"
+
+static const char *categoryNames[] = {
+    "vertex", "index", "uniform", "texture", "depth", "staging", "other",
+};
+
+static double megabytes(VkDeviceSize bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+void MemoryTracker::Usage::add(VkDeviceSize size) {
+    bytes += size;
+    peak = std::max(peak, bytes);
+    count++;
+}
+
+void MemoryTracker::Usage::remove(VkDeviceSize size) {
+    bytes -= size;
+    count--;
+}
+
+MemoryTracker::MemoryTracker(VkInstance instance, VkPhysicalDevice physical,
+                             bool budgetSupported)
+: physical(physical)
+{
+    vkGetPhysicalDeviceMemoryProperties(physical, &properties);
+    if (budgetSupported) {
+        getProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)
+            vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+    }
+}
+
+void MemoryTracker::allocated(VkDeviceMemory memory, VkDeviceSize size,
+                              uint32_t typeIndex, MemoryCategory category)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    allocations[memory] = {size, typeIndex, category};
+    heaps[properties.memoryTypes[typeIndex].heapIndex].add(size);
+    types[typeIndex].add(size);
+    categories[category].add(size);
+}
+
+void MemoryTracker::freed(VkDeviceMemory memory) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = allocations.find(memory);
+    if (it == allocations.end()) {
+        return;
+    }
+    const Allocation& allocation = it->second;
+    heaps[properties.memoryTypes[allocation.typeIndex].heapIndex].remove(allocation.size);
+    types[allocation.typeIndex].remove(allocation.size);
+    categories[allocation.category].remove(allocation.size);
+    allocations.erase(it);
+}
+
+// VK_EXT_memory_budget reports this process's usage per heap, including
+// driver-internal memory we never see, and how much it may use before
+// allocations start failing or paging. Returns false when unavailable.
+bool MemoryTracker::queryBudget(VkDeviceSize *budget, VkDeviceSize *usage) {
+    if (!getProperties2) {
+        return false;
+    }
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+    budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    VkPhysicalDeviceMemoryProperties2KHR properties2 = {};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+    properties2.pNext = &budgetProperties;
+    getProperties2(physical, &properties2);
+
+    for (uint32_t i = 0; i < properties.memoryHeapCount; i++) {
+        budget[i] = budgetProperties.heapBudget[i];
+        usage[i] = budgetProperties.heapUsage[i];
+    }
+    return true;
+}
+
+void MemoryTracker::report(std::ostream& out) {
+    VkDeviceSize budget[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize usage[VK_MAX_MEMORY_HEAPS];
+    bool hasBudget = queryBudget(budget, usage);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint32_t i = 0; i < properties.memoryHeapCount; i++) {
+        const auto& heap = properties.memoryHeaps[i];
+        out << "heap " << i
+            << ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " (device local)" : "")
+            << ": " << megabytes(heaps[i].bytes) << " MB in " << heaps[i].count
+            << " allocations, peak " << megabytes(heaps[i].peak)
+            << " MB, size " << megabytes(heap.size) << " MB";
+        if (hasBudget) {
+            out << ", budget " << megabytes(budget[i])
+                << " MB, process usage " << megabytes(usage[i]) << " MB";
+        }
+        out << std::endl;
+    }
+    for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+        if (types[i].count == 0) {
+            continue;
+        }
+        out << "  type " << i << " (heap " << properties.memoryTypes[i].heapIndex
+            << ", flags 0x" << std::hex << properties.memoryTypes[i].propertyFlags
+            << std::dec << "): " << megabytes(types[i].bytes) << " MB" << std::endl;
+    }
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+        if (categories[i].peak == 0) {
+            continue;
+        }
+        out << "  " << categoryNames[i] << ": " << megabytes(categories[i].bytes)
+            << " MB in " << categories[i].count << " allocations, peak "
+            << megabytes(categories[i].peak) << " MB" << std::endl;
+    }
+}
+
+void MemoryTracker::dumpJson(std::ostream& out) {
+    VkDeviceSize budget[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize usage[VK_MAX_MEMORY_HEAPS];
+    bool hasBudget = queryBudget(budget, usage);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    out << "{\"heaps\":[";
+    for (uint32_t i = 0; i < properties.memoryHeapCount; i++) {
+        const auto& heap = properties.memoryHeaps[i];
+        out << (i ? "," : "") << "{\"index\":" << i
+            << ",\"deviceLocal\":"
+            << ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? "true" : "false")
+            << ",\"size\":" << heap.size
+            << ",\"allocated\":" << heaps[i].bytes
+            << ",\"peak\":" << heaps[i].peak
+            << ",\"allocations\":" << heaps[i].count;
+        if (hasBudget) {
+            out << ",\"budget\":" << budget[i] << ",\"usage\":" << usage[i];
+        }
+        out << "}";
+    }
+    out << "],\"types\":[";
+    for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+        out << (i ? "," : "") << "{\"index\":" << i
+            << ",\"heap\":" << properties.memoryTypes[i].heapIndex
+            << ",\"flags\":" << properties.memoryTypes[i].propertyFlags
+            << ",\"allocated\":" << types[i].bytes
+            << ",\"peak\":" << types[i].peak
+            << ",\"allocations\":" << types[i].count << "}";
+    }
+    out << "],\"categories\":{";
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+        out << (i ? "," : "") << "\"" << categoryNames[i] << "\":{"
+            << "\"allocated\":" << categories[i].bytes
+            << ",\"peak\":" << categories[i].peak
+            << ",\"allocations\":" << categories[i].count << "}";
+    }
+    out << "}}" << std::endl;
+}
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <cmath>
+#include "vk.h"
+
+// Sphere around the meshlet's vertices, and a cone bounding its triangle
+// normals. When the normals spread over more than a hemisphere the cutoff
+// is 1, which the back-facing test can never pass.
+static void computeBounds(const std::vector<Vertex>& vertices, MeshletData& data,
+                          Meshlet& meshlet)
+{
+    const uint32_t *local = &data.vertices[meshlet.vertexOffset];
+    glm::vec3 low = vertices[local[0]].pos;
+    glm::vec3 high = low;
+    for (uint32_t i = 1; i < meshlet.vertexCount; i++) {
+        low = glm::min(low, vertices[local[i]].pos);
+        high = glm::max(high, vertices[local[i]].pos);
+    }
+    glm::vec3 center = (low + high) * 0.5f;
+    float radius = 0.0f;
+    for (uint32_t i = 0; i < meshlet.vertexCount; i++) {
+        radius = std::max(radius, glm::length(vertices[local[i]].pos - center));
+    }
+    meshlet.sphere = glm::vec4(center, radius);
+
+    std::vector<glm::vec3> normals;
+    glm::vec3 axis(0.0f);
+    for (uint32_t t = 0; t < meshlet.triangleCount; t++) {
+        uint32_t packed = data.triangles[meshlet.triangleOffset + t];
+        const glm::vec3& a = vertices[local[packed & 0xff]].pos;
+        const glm::vec3& b = vertices[local[(packed >> 8) & 0xff]].pos;
+        const glm::vec3& c = vertices[local[(packed >> 16) & 0xff]].pos;
+        glm::vec3 normal = glm::cross(b - a, c - a);
+        float length = glm::length(normal);
+        if (length > 0.0f) {
+            normals.push_back(normal / length);
+            axis += normals.back();
+        }
+    }
+
+    float axisLength = glm::length(axis);
+    if (normals.empty() || axisLength == 0.0f) {
+        meshlet.cone = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        return;
+    }
+    axis /= axisLength;
+    float minDot = 1.0f;
+    for (const auto& normal : normals) {
+        minDot = std::min(minDot, glm::dot(axis, normal));
+    }
+    // cone.w is the sine of the widest normal's angle from the axis; a view
+    // direction within 90 degrees minus that angle of the axis sees only
+    // back faces.
+    float cutoff = minDot <= 0.0f ? 1.0f : std::sqrt(1.0f - minDot * minDot);
+    meshlet.cone = glm::vec4(axis, cutoff);
+}
+
+// Greedy partition in index order: triangles are appended to the current
+// meshlet until one more would exceed maxVertices or maxTriangles. Index
+// order from the OBJ loader is spatially coherent enough that this yields
+// compact clusters without a separate spatial pass.
+MeshletData buildMeshlets(const std::vector<Vertex>& vertices, const uint32_t *indices,
+                          size_t indexCount, uint32_t maxVertices, uint32_t maxTriangles)
+{
+    TRACE_SCOPE("build meshlets");
+    if (maxVertices > 256) {
+        throw std::runtime_error("meshlets store 8-bit local vertex indices!");
+    }
+
+    MeshletData data;
+    // Local index of each mesh vertex in the current meshlet, or ~0.
+    std::vector<uint32_t> localIndex(vertices.size(), ~0u);
+    Meshlet current = {};
+
+    auto flush = [&]() {
+        if (current.triangleCount == 0) {
+            return;
+        }
+        computeBounds(vertices, data, current);
+        data.meshlets.push_back(current);
+        for (uint32_t i = 0; i < current.vertexCount; i++) {
+            localIndex[data.vertices[current.vertexOffset + i]] = ~0u;
+        }
+        current = {};
+        current.vertexOffset = data.vertices.size();
+        current.triangleOffset = data.triangles.size();
+    };
+
+    for (size_t i = 0; i + 2 < indexCount; i += 3) {
+        uint32_t added = 0;
+        for (int k = 0; k < 3; k++) {
+            added += localIndex[indices[i + k]] == ~0u;
+        }
+        if (current.vertexCount + added > maxVertices || current.triangleCount == maxTriangles) {
+            flush();
+        }
+
+        uint32_t packed = 0;
+        for (int k = 0; k < 3; k++) {
+            uint32_t& local = localIndex[indices[i + k]];
+            if (local == ~0u) {
+                local = current.vertexCount++;
+                data.vertices.push_back(indices[i + k]);
+            }
+            packed |= local << (k * 8);
+        }
+        data.triangles.push_back(packed);
+        current.triangleCount++;
+    }
+    flush();
+    return data;
+}
@@ -10,17 +10,28 @@ Model::Model(Texture texture, const std::string& filename)
     std::vector<tinyobj::material_t> materials;
     std::string err;
 
-    auto res = tinyobj::LoadObj(&attrib, &shapes, &materials,
-                                &err, filename.c_str());
-    if (!res) {
-        throw std::runtime_error(err);
+    {
+        TRACE_SCOPE("LoadObj");
+        auto res = tinyobj::LoadObj(&attrib, &shapes, &materials,
+                                    &err, filename.c_str());
+        if (!res) {
+            throw std::runtime_error(err);
+        }
     }
 
-    std::unordered_map<Vertex, int> uniqueVertices = {};
+    JobSystem& jobs = JobSystem::get();
 
+    // Corners are expanded in parallel; only the dedup itself is serial.
+    std::vector<tinyobj::index_t> objIndices;
     for (const auto& shape : shapes) {
-        for (const auto& index : shape.mesh.indices) {
-            Vertex vertex = {};
+        objIndices.insert(objIndices.end(), shape.mesh.indices.begin(), shape.mesh.indices.end());
+    }
+    std::vector<Vertex> corners(objIndices.size());
+    jobs.parallelFor(corners.size(), 16384, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const auto& index = objIndices[i];
+            Vertex& vertex = corners[i];
+            vertex = {};
             vertex.pos = {
                 attrib.vertices[3 * index.vertex_index],
                 attrib.vertices[3 * index.vertex_index + 1],
@@ -33,15 +44,40 @@ Model::Model(Texture texture, const std::string& filename)
             };
 
             vertex.color = {1.0f, 1.0f, 1.0f};
+        }
+    });
 
-            if (uniqueVertices.count(vertex) == 0) {
-                uniqueVertices[vertex] = vertices.size();
+    {
+        TRACE_SCOPE("dedup vertices");
+        std::unordered_map<Vertex, int> uniqueVertices = {};
+        uniqueVertices.reserve(corners.size() / 4);
+        indices.reserve(corners.size());
+        for (const auto& vertex : corners) {
+            auto inserted = uniqueVertices.emplace(vertex, vertices.size());
+            if (inserted.second) {
                 vertices.push_back(vertex);
             }
-
-            indices.push_back(uniqueVertices[vertex]);
+            indices.push_back(inserted.first->second);
         }
+    }
 
+    // Meshlets only read the full-detail range, so they are built while the
+    // levels of detail are simplified. Simplified levels are appended to
+    // indices and share the vertex array.
+    std::vector<uint32_t> baseIndices = indices;
+    auto meshletJob = jobs.spawn([this, &baseIndices] {
+        clusters = buildMeshlets(vertices, baseIndices.data(), baseIndices.size());
+    });
+    std::exception_ptr error;
+    try {
+        sphere = boundingSphere(vertices);
+        levels = buildLods(vertices, indices);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    jobs.wait(meshletJob);
+    if (error) {
+        std::rethrow_exception(error);
     }
 
     indexBuffer = Buffer(deviceptr,
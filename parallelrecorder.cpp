@@ -0,0 +1,105 @@
+#include <algorithm>
+#include "vk.h"
+
+// Fewer draws than this per partition costs more in secondary buffer
+// overhead and thread handoff than recording them inline.
+static const size_t minDrawsPerPartition = 256;
+
+ParallelRecorder::ParallelRecorder(std::shared_ptr<Device> deviceptr, uint32_t framesInFlight,
+                                   unsigned slots)
+: deviceptr(deviceptr), device(*deviceptr.get()), framesInFlight(framesInFlight),
+  slotCount(std::max(1u, slots))
+{
+    // Pools are not thread safe, so each slot gets its own per frame; a
+    // slot is recorded by exactly one job at a time. Every pool holds a
+    // single buffer re-recorded each frame, so it is transient and reset
+    // as a whole.
+    for (unsigned slot = 0; slot < slotCount; slot++) {
+        for (uint32_t frame = 0; frame < framesInFlight; frame++) {
+            pools.emplace_back(new CommandPool(deviceptr, -1, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT));
+
+            VkCommandBufferAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = *pools.back();
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+            VkCommandBuffer buffer;
+            if (vkAllocateCommandBuffers(device, &allocInfo, &buffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate secondary command buffer!");
+            }
+            debug::setName(device, VK_OBJECT_TYPE_COMMAND_BUFFER, (uint64_t) buffer,
+                           "draw partition");
+            buffers.push_back(buffer);
+        }
+    }
+}
+
+ParallelRecorder::~ParallelRecorder() {
+    for (size_t i = 0; i < buffers.size(); i++) {
+        vkFreeCommandBuffers(device, *pools[i], 1, &buffers[i]);
+    }
+}
+
+uint32_t ParallelRecorder::partitions(size_t drawCount) const {
+    return (uint32_t) std::min<size_t>(slotCount, std::max<size_t>(1, drawCount / minDrawsPerPartition));
+}
+
+// Splits the sorted queue into contiguous ranges, one secondary buffer
+// each, so every range keeps the queue's state ordering. setup records
+// state that secondaries do not inherit, such as viewport and scissor.
+// Per-draw queries are not recorded because QueryProfiler is used from
+// one thread only; queries open in the primary must be declared in
+// inheritance (see QueryProfiler::inherit). The buffers last returned for
+// frameIndex must no longer be pending.
+RenderQueue::Stats ParallelRecorder::record(const RenderQueue& renderQueue, uint32_t frameIndex,
+                                            const VkCommandBufferInheritanceInfo& inheritance,
+                                            const std::function<void(VkCommandBuffer)>& setup,
+                                            std::vector<VkCommandBuffer>& secondaries)
+{
+    TRACE_SCOPE("record partitions");
+    uint32_t count = partitions(renderQueue.size());
+    size_t perPartition = (renderQueue.size() + count - 1) / count;
+    secondaries.clear();
+
+    auto recordPartition = [this, &renderQueue, &inheritance, &setup, perPartition, frameIndex]
+        (uint32_t partition)
+    {
+        TRACE_SCOPE("record partition");
+        size_t slot = partition * framesInFlight + frameIndex % framesInFlight;
+        VkCommandBuffer buffer = buffers[slot];
+        pools[slot]->reset();
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT
+            | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        beginInfo.pInheritanceInfo = &inheritance;
+        vkBeginCommandBuffer(buffer, &beginInfo);
+        setup(buffer);
+        size_t begin = std::min(renderQueue.size(), partition * perPartition);
+        size_t end = std::min(renderQueue.size(), begin + perPartition);
+        RenderQueue::Stats stats = renderQueue.record(buffer, begin, end);
+        if (vkEndCommandBuffer(buffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record secondary command buffer!");
+        }
+        return stats;
+    };
+
+    // Partitions are independent, so each one is a job; the calling thread
+    // records some of them while it waits.
+    std::vector<RenderQueue::Stats> stats(count);
+    JobSystem::get().parallelFor(count, 1, [&](size_t first, size_t last) {
+        for (size_t partition = first; partition < last; partition++) {
+            stats[partition] = recordPartition(partition);
+        }
+    });
+
+    RenderQueue::Stats total;
+    for (uint32_t partition = 0; partition < count; partition++) {
+        total.draws += stats[partition].draws;
+        total.binds += stats[partition].binds;
+        total.elided += stats[partition].elided;
+        secondaries.push_back(buffers[partition * framesInFlight + frameIndex % framesInFlight]);
+    }
+    return total;
+}
@@ -1,13 +1,11 @@
 class Pipeline {
 public:
     Pipeline(std::shared_ptr<Device> deviceptr,
-             const SwapChain& swapChain,
-             const RenderPass& renderPass,
-             const DescriptorSet& descriptorSet,
-             const VertexShader& vertShader,
-             const FragmentShader& fragShader);
+             const PipelineDesc& desc,
+             LayoutCache& layouts,
+             VkPipelineCache cache = VK_NULL_HANDLE);
     ~Pipeline();
-    operator VkPipeline() { return set; }
+    operator VkPipeline() { return pipeline; }
     operator VkPipelineLayout() { return layout; }
 
 private:
@@ -15,33 +13,70 @@ private:
     Device device;
     VkPipeline pipeline;
 
-    const VkPipelineLayout& layout;
-    const VertexShader& vertexShader;
-    const FragmentShader& fragmentShader;
+    VkPipelineLayout layout;
+    std::shared_ptr<Shader> vertShader;
+    std::shared_ptr<Shader> fragShader;
 };
 
+class ComputePipeline {
+public:
+    ComputePipeline(std::shared_ptr<Device> deviceptr,
+                    std::shared_ptr<Shader> shader,
+                    LayoutCache& layouts,
+                    uint32_t features = 0,
+                    VkPipelineCache cache = VK_NULL_HANDLE);
+    ~ComputePipeline();
+    operator VkPipeline() { return pipeline; }
+    operator VkPipelineLayout() { return layout; }
+
+private:
+    std::shared_ptr<Device> deviceptr;
+    Device device;
+    VkPipeline pipeline;
+
+    VkPipelineLayout layout;
+    std::shared_ptr<Shader> shader;
+};
+
+static void checkVertexInputs(
+    const ShaderReflection& reflection,
+    const std::vector<VkVertexInputAttributeDescription>& attributes)
+{
+    for (const auto& input : reflection.inputs) {
+        bool found = false;
+        for (const auto& attribute : attributes) {
+            if (attribute.location == input.location) {
+                if (attribute.format != input.format) {
+                    throw std::runtime_error("vertex attribute format does not match shader input!");
+                }
+                found = true;
+            }
+        }
+        if (!found) {
+            throw std::runtime_error("shader input has no vertex attribute!");
+        }
+    }
+}
+
 Pipeline::Pipeline(std::shared_ptr<Device> deviceptr,
-                   const SwapChain& swapChain
-                   const RenderPass& renderPass,
-                   const DescriptorSet& descriptorSet,
-                   const VertexShader& vertShader,
-                   const FragmentShader& fragShader);
-: deviceptr(deviceptr), device(*deviceptr.get()), swapChain(swapChain),
-  renderPass(renderPass), vertShader(vertShader), fragShader(fragShader),
+                   const PipelineDesc& desc,
+                   LayoutCache& layouts,
+                   VkPipelineCache cache)
+: deviceptr(deviceptr), device(*deviceptr.get()),
+  vertShader(desc.vertShader), fragShader(desc.fragShader)
 {
-    //const std::string vertShaderName("shaders/vert.spv");
-    //const std::string fragShaderName("shaders/frag.spv");
-    auto vertShaderStageInfo = vertShader.stageInfo();
-    auto fragShaderStageInfo = fragShader.stageInfo();
+    auto vertShaderStageInfo = vertShader->stageInfo(desc.features);
+    auto fragShaderStageInfo = fragShader->stageInfo(desc.features);
     VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
     
-    auto bindingDescription = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
+    auto bindingDescriptions = Vertex::getBindingDescriptions(desc.instanced);
+    auto attributeDescriptions = Vertex::getAttributeDescriptions(desc.instanced);
+    checkVertexInputs(vertShader->reflection(), attributeDescriptions);
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexBindingDescriptionCount = bindingDescriptions.size();
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
     vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
     vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
@@ -50,24 +85,21 @@ Pipeline::Pipeline(std::shared_ptr<Device> deviceptr,
     inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
     inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-    VkViewport viewport = {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float) swapChain.extent.width;
-    viewport.height = (float) swapChain.extent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    VkRect2D scissor = {};
-    scissor.offset = {0, 0};
-    scissor.extent = swapChain.extent;
-
+    // Viewport and scissor are dynamic so a swapchain resize does not
+    // invalidate compiled pipelines.
     VkPipelineViewportStateCreateInfo viewportState = {};
     viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
     viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
+
+    VkDynamicState dynamicStates[] = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR
+    };
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
 
     VkPipelineRasterizationStateCreateInfo rasterizer = {};
     rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -75,7 +107,7 @@ Pipeline::Pipeline(std::shared_ptr<Device> deviceptr,
     rasterizer.rasterizerDiscardEnable = VK_FALSE;
     rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
     rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+    rasterizer.cullMode = desc.cullMode;
     rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
     rasterizer.depthBiasEnable = VK_FALSE;
 
@@ -87,7 +119,13 @@ Pipeline::Pipeline(std::shared_ptr<Device> deviceptr,
 
     VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
     colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
+    colorBlendAttachment.blendEnable = desc.blend;
+    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
 
     VkPipelineColorBlendStateCreateInfo colorBlending = {};
     colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
@@ -95,22 +133,13 @@ Pipeline::Pipeline(std::shared_ptr<Device> deviceptr,
     colorBlending.attachmentCount = 1;
     colorBlending.pAttachments = &colorBlendAttachment;
 
-    VkDescriptorSetLayout setLayouts[] = {descriptorSet.layout};
-
-    VkPipelineLayoutCreateInfo layoutInfo = {};
-    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    layoutInfo.setLayoutCount = 1;
-    layoutInfo.pSetLayouts = setLayouts;
-
-    auto res = vkCreatePipelineLayout(device, &layoutInfo, nullptr, layout&);
-    if (res != VK_SUCCESS) {
-        throw std::runtime_error("failed to create pipeline layout!");
-    }
+    layout = layouts.pipelineLayout({&vertShader->reflection(),
+                                     &fragShader->reflection()}).layout;
 
     VkPipelineDepthStencilStateCreateInfo depthStencil = {};
     depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    depthStencil.depthTestEnable = VK_TRUE;
-    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthTestEnable = desc.depthTest;
+    depthStencil.depthWriteEnable = desc.depthTest;
 
     depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
     depthStencil.depthBoundsTestEnable = VK_FALSE;
@@ -127,21 +156,52 @@ Pipeline::Pipeline(std::shared_ptr<Device> deviceptr,
     info.pRasterizationState = &rasterizer;
     info.pMultisampleState = &multisampling;
     info.pColorBlendState = &colorBlending;
+    info.pDynamicState = &dynamicState;
 
     info.layout = layout;
-    info.renderPass = renderPass;
-    info.subpass = 0;
+    info.renderPass = desc.renderPass;
+    info.subpass = desc.subpass;
     info.basePipelineHandle = VK_NULL_HANDLE;
 
     info.pDepthStencilState = &depthStencil;
 
-    auto res = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &info, nullptr, &pipeline);
+    auto res = vkCreateGraphicsPipelines(device, cache, 1, &info, nullptr, &pipeline);
     if (res != VK_SUCCESS) {
             throw std::runtime_error("failed to create graphics pipeline!");
     }
+    std::string name = vertShader->path() + " + " + fragShader->path();
+    debug::setName(device, VK_OBJECT_TYPE_PIPELINE, (uint64_t) pipeline, name.c_str());
 }
 
 Pipeline::~Pipeline() {
     vkDestroyPipeline(device, pipeline)
-    vkDestroyPipelineLayout(device, layout)
+}
+
+ComputePipeline::ComputePipeline(std::shared_ptr<Device> deviceptr,
+                                 std::shared_ptr<Shader> shader,
+                                 LayoutCache& layouts,
+                                 uint32_t features,
+                                 VkPipelineCache cache)
+: deviceptr(deviceptr), device(*deviceptr.get()), shader(shader)
+{
+    if (shader->reflection().stage != VK_SHADER_STAGE_COMPUTE_BIT) {
+        throw std::runtime_error("compute pipeline needs a compute shader: " + shader->path());
+    }
+    layout = layouts.pipelineLayout({&shader->reflection()}).layout;
+
+    VkComputePipelineCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    info.stage = shader->stageInfo(features);
+    info.layout = layout;
+    info.basePipelineHandle = VK_NULL_HANDLE;
+
+    auto res = vkCreateComputePipelines(device, cache, 1, &info, nullptr, &pipeline);
+    if (res != VK_SUCCESS) {
+            throw std::runtime_error("failed to create compute pipeline!");
+    }
+    debug::setName(device, VK_OBJECT_TYPE_PIPELINE, (uint64_t) pipeline, shader->path().c_str());
+}
+
+ComputePipeline::~ComputePipeline() {
+    vkDestroyPipeline(device, pipeline, nullptr);
 }
@@ -0,0 +1,155 @@
+#include <fstream>
+#include <algorithm>
+#include "vk.h"
+
+uint64_t PipelineDesc::key() const {
+    uint32_t usedFeatures = features
+        & (vertShader->featureMask() | fragShader->featureMask());
+
+    const uint64_t fields[] = {
+        (uint64_t) vertShader.get(),
+        (uint64_t) fragShader.get(),
+        (uint64_t) renderPass,
+        subpass,
+        cullMode,
+        depthTest,
+        blend,
+        instanced,
+        usedFeatures,
+    };
+
+    uint64_t hash = 14695981039346656037ull;
+    for (uint64_t field : fields) {
+        for (int i = 0; i < 8; i++) {
+            hash ^= (field >> (i * 8)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+PipelineCompiler::PipelineCompiler(std::shared_ptr<Device> deviceptr,
+                                   LayoutCache& layouts,
+                                   const std::string& cacheFile,
+                                   unsigned workers)
+: deviceptr(deviceptr), device(*deviceptr.get()), layouts(layouts),
+  cacheFile(cacheFile)
+{
+    createCache();
+    for (unsigned i = 0; i < std::max(1u, workers); i++) {
+        threads.emplace_back(&PipelineCompiler::work, this);
+    }
+}
+
+PipelineCompiler::~PipelineCompiler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    saveCache();
+    vkDestroyPipelineCache(device, cache, nullptr);
+}
+
+void PipelineCompiler::createCache() {
+    std::vector<char> data;
+    std::ifstream file(cacheFile, std::ios::ate | std::ios::binary);
+    if (file.is_open()) {
+        data.resize((size_t) file.tellg());
+        file.seekg(0);
+        file.read(data.data(), data.size());
+    }
+
+    VkPipelineCacheCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    info.initialDataSize = data.size();
+    info.pInitialData = data.empty() ? nullptr : data.data();
+
+    if (vkCreatePipelineCache(device, &info, nullptr, &cache) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline cache!");
+    }
+}
+
+void PipelineCompiler::saveCache() {
+    size_t size = 0;
+    vkGetPipelineCacheData(device, cache, &size, nullptr);
+    std::vector<char> data(size);
+    if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS) {
+        return;
+    }
+    std::ofstream file(cacheFile, std::ios::binary);
+    file.write(data.data(), size);
+}
+
+void PipelineCompiler::work() {
+    for (;;) {
+        std::packaged_task<std::shared_ptr<Pipeline>()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping && queue.empty()) {
+                return;
+            }
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+        task();
+    }
+}
+
+PipelineCompiler::Future PipelineCompiler::compile(const PipelineDesc& desc) {
+    uint64_t key = desc.key();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = pipelines.find(key);
+    if (it != pipelines.end()) {
+        return it->second.future;
+    }
+
+    std::packaged_task<std::shared_ptr<Pipeline>()> task([this, desc] {
+        return std::make_shared<Pipeline>(deviceptr, desc, layouts, cache);
+    });
+    Future future = task.get_future().share();
+    pipelines[key] = {desc.renderPass, future};
+    queue.push_back(std::move(task));
+    ready.notify_one();
+    return future;
+}
+
+std::shared_ptr<Pipeline> PipelineCompiler::find(const PipelineDesc& desc,
+                                                 std::shared_ptr<Pipeline> fallback)
+{
+    Future future = compile(desc);
+    if (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return fallback;
+    }
+    try {
+        return future.get();
+    } catch (const std::runtime_error&) {
+        return fallback;
+    }
+}
+
+// The key hashes the render pass handle, so entries for a destroyed pass
+// would otherwise pile up with each resize and could be returned for a new
+// pass that reuses the handle value.
+void PipelineCompiler::evict(VkRenderPass renderPass) {
+    std::vector<Future> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = pipelines.begin(); it != pipelines.end(); ) {
+            if (it->second.renderPass == renderPass) {
+                evicted.push_back(it->second.future);
+                it = pipelines.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (auto& future : evicted) {
+        future.wait();
+    }
+}
@@ -0,0 +1,189 @@
+#include <cstring>
+#include "vk.h"
+
+// Results come back in ascending bit order, matching statisticNames.
+static const VkQueryPipelineStatisticFlags statisticFlags =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT
+    | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+    | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT
+    | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT
+    | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+static const char *statisticNames[] = {
+    "ia vertices",
+    "vs invocations",
+    "clipping invocations",
+    "clipping primitives",
+    "fs invocations",
+};
+
+static const uint32_t statisticCount = sizeof(statisticNames) / sizeof(statisticNames[0]);
+
+// Parses a comma separated list such as "pipeline,occlusion,draw".
+uint32_t QueryProfiler::parse(const char *spec, Granularity& granularity) {
+    granularity = PER_PASS;
+    if (!spec) {
+        return 0;
+    }
+    uint32_t flags = 0;
+    if (strstr(spec, "pipeline")) {
+        flags |= PIPELINE_STATISTICS;
+    }
+    if (strstr(spec, "occlusion")) {
+        flags |= OCCLUSION;
+    }
+    if (strstr(spec, "draw")) {
+        granularity = PER_DRAW;
+    }
+    return flags;
+}
+
+QueryProfiler::QueryProfiler(std::shared_ptr<Device> deviceptr, FrameStats& stats,
+                             uint32_t framesInFlight, uint32_t flags,
+                             Granularity granularity, uint32_t maxScopesPerFrame)
+: deviceptr(deviceptr), device(*deviceptr.get()), stats(stats), flags(flags),
+  granularity(granularity), framesInFlight(framesInFlight),
+  maxScopes(maxScopesPerFrame), scopes(framesInFlight)
+{
+    if ((flags & PIPELINE_STATISTICS) && !device.features().pipelineStatisticsQuery) {
+        std::cout << "pipeline statistics queries unsupported, skipping" << std::endl;
+        this->flags &= ~PIPELINE_STATISTICS;
+    }
+    if (this->flags & PIPELINE_STATISTICS) {
+        statisticsPool = createPool(VK_QUERY_TYPE_PIPELINE_STATISTICS, statisticFlags);
+    }
+    if (this->flags & OCCLUSION) {
+        occlusionPool = createPool(VK_QUERY_TYPE_OCCLUSION, 0);
+        if (device.features().occlusionQueryPrecise) {
+            occlusionControl = VK_QUERY_CONTROL_PRECISE_BIT;
+        }
+    }
+}
+
+QueryProfiler::~QueryProfiler() {
+    if (statisticsPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, statisticsPool, nullptr);
+    }
+    if (occlusionPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, occlusionPool, nullptr);
+    }
+}
+
+VkQueryPool QueryProfiler::createPool(VkQueryType type,
+                                      VkQueryPipelineStatisticFlags statistics)
+{
+    VkQueryPoolCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    info.queryType = type;
+    info.queryCount = framesInFlight * maxScopes;
+    info.pipelineStatistics = statistics;
+
+    VkQueryPool pool;
+    if (vkCreateQueryPool(device, &info, nullptr, &pool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create query pool!");
+    }
+    return pool;
+}
+
+// Declares the queries an open pass scope keeps active in secondary command
+// buffers executed inside it. Returns false when the device cannot inherit
+// queries; the pass scope must then be closed while secondaries execute.
+bool QueryProfiler::inherit(VkCommandBufferInheritanceInfo& info) const {
+    if (flags == 0 || granularity != PER_PASS) {
+        return true;
+    }
+    if (!device.features().inheritedQueries) {
+        return false;
+    }
+    info.occlusionQueryEnable = occlusionPool != VK_NULL_HANDLE;
+    info.queryFlags = occlusionControl;
+    info.pipelineStatistics = statisticsPool != VK_NULL_HANDLE ? statisticFlags : 0;
+    return true;
+}
+
+// Must be recorded outside a render pass, like GpuProfiler::beginFrame.
+void QueryProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+    if (flags == 0) {
+        return;
+    }
+    frame = frameIndex % framesInFlight;
+    collect(frame);
+    scopes[frame].clear();
+    if (statisticsPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(commandBuffer, statisticsPool, frame * maxScopes, maxScopes);
+    }
+    if (occlusionPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(commandBuffer, occlusionPool, frame * maxScopes, maxScopes);
+    }
+}
+
+uint32_t QueryProfiler::begin(VkCommandBuffer commandBuffer, const char *name,
+                              Granularity level)
+{
+    auto& frameScopes = scopes[frame];
+    if (flags == 0 || level != granularity || frameScopes.size() >= maxScopes) {
+        return UINT32_MAX;
+    }
+    uint32_t query = frame * maxScopes + frameScopes.size();
+    frameScopes.push_back({name, query});
+    if (statisticsPool != VK_NULL_HANDLE) {
+        vkCmdBeginQuery(commandBuffer, statisticsPool, query, 0);
+    }
+    if (occlusionPool != VK_NULL_HANDLE) {
+        vkCmdBeginQuery(commandBuffer, occlusionPool, query, occlusionControl);
+    }
+    return frameScopes.size() - 1;
+}
+
+void QueryProfiler::end(VkCommandBuffer commandBuffer, uint32_t scope) {
+    if (scope == UINT32_MAX) {
+        return;
+    }
+    uint32_t query = scopes[frame][scope].query;
+    if (occlusionPool != VK_NULL_HANDLE) {
+        vkCmdEndQuery(commandBuffer, occlusionPool, query);
+    }
+    if (statisticsPool != VK_NULL_HANDLE) {
+        vkCmdEndQuery(commandBuffer, statisticsPool, query);
+    }
+}
+
+void QueryProfiler::collect(uint32_t frameIndex) {
+    const auto& frameScopes = scopes[frameIndex];
+    if (frameScopes.empty()) {
+        return;
+    }
+    uint32_t first = frameIndex * maxScopes;
+    uint32_t count = frameScopes.size();
+
+    if (statisticsPool != VK_NULL_HANDLE) {
+        std::vector<uint64_t> results(count * statisticCount);
+        auto res = vkGetQueryPoolResults(device, statisticsPool, first, count,
+                                         results.size() * sizeof(uint64_t),
+                                         results.data(),
+                                         statisticCount * sizeof(uint64_t),
+                                         VK_QUERY_RESULT_64_BIT);
+        if (res == VK_SUCCESS) {
+            for (uint32_t i = 0; i < count; i++) {
+                for (uint32_t j = 0; j < statisticCount; j++) {
+                    stats.counter(std::string(frameScopes[i].name) + " " + statisticNames[j],
+                                  results[i * statisticCount + j]);
+                }
+            }
+        }
+    }
+
+    if (occlusionPool != VK_NULL_HANDLE) {
+        std::vector<uint64_t> samples(count);
+        auto res = vkGetQueryPoolResults(device, occlusionPool, first, count,
+                                         samples.size() * sizeof(uint64_t),
+                                         samples.data(), sizeof(uint64_t),
+                                         VK_QUERY_RESULT_64_BIT);
+        if (res == VK_SUCCESS) {
+            for (uint32_t i = 0; i < count; i++) {
+                stats.counter(std::string(frameScopes[i].name) + " samples passed",
+                              samples[i]);
+            }
+        }
+    }
+}
@@ -0,0 +1,387 @@
+#include <algorithm>
+#include <unordered_map>
+#include <stdexcept>
+#include "vk.h"
+
+// Minimal SPIR-V walker: only the opcodes, decorations and storage classes
+// needed to recover descriptor bindings, push constants and vertex inputs.
+namespace spv {
+    const uint32_t MagicNumber = 0x07230203;
+
+    enum Op {
+        OpEntryPoint = 15,
+        OpTypeBool = 20,
+        OpTypeInt = 21,
+        OpTypeFloat = 22,
+        OpTypeVector = 23,
+        OpTypeMatrix = 24,
+        OpTypeImage = 25,
+        OpTypeSampler = 26,
+        OpTypeSampledImage = 27,
+        OpTypeArray = 28,
+        OpTypeRuntimeArray = 29,
+        OpTypeStruct = 30,
+        OpTypePointer = 32,
+        OpConstant = 43,
+        OpSpecConstantTrue = 48,
+        OpSpecConstantFalse = 49,
+        OpSpecConstant = 50,
+        OpVariable = 59,
+        OpDecorate = 71,
+        OpMemberDecorate = 72,
+    };
+
+    enum Decoration {
+        SpecId = 1,
+        Block = 2,
+        BufferBlock = 3,
+        ArrayStride = 6,
+        MatrixStride = 7,
+        BuiltIn = 11,
+        Location = 30,
+        Binding = 33,
+        DescriptorSet = 34,
+        Offset = 35,
+    };
+
+    enum StorageClass {
+        UniformConstant = 0,
+        Input = 1,
+        Uniform = 2,
+        PushConstant = 9,
+        StorageBuffer = 12,
+    };
+
+    enum ExecutionModel {
+        Vertex = 0,
+        TessellationControl = 1,
+        TessellationEvaluation = 2,
+        Geometry = 3,
+        Fragment = 4,
+        GLCompute = 5,
+    };
+}
+
+namespace {
+
+struct SpirvType {
+    uint32_t op = 0;
+    uint32_t width = 0;
+    uint32_t signedness = 0;
+    uint32_t element = 0;
+    uint32_t count = 0;
+    uint32_t storage = 0;
+    uint32_t sampled = 0;
+    std::vector<uint32_t> members;
+};
+
+struct SpirvVariable {
+    uint32_t type;
+    uint32_t storage;
+};
+
+class SpirvModule {
+public:
+    SpirvModule(const uint32_t *words, size_t count);
+
+    VkShaderStageFlagBits stage = VK_SHADER_STAGE_ALL;
+    std::unordered_map<uint32_t, SpirvType> types;
+    std::unordered_map<uint32_t, uint32_t> constants;
+    std::unordered_map<uint32_t, SpirvVariable> variables;
+    std::unordered_map<uint32_t, uint32_t> specConstants;
+    std::unordered_map<uint32_t, std::map<uint32_t, uint32_t>> decorations;
+    std::unordered_map<uint32_t, std::map<uint32_t, std::map<uint32_t, uint32_t>>> memberDecorations;
+
+    bool decorated(uint32_t id, uint32_t decoration) const;
+    uint32_t decoration(uint32_t id, uint32_t decoration) const;
+    uint32_t memberDecoration(uint32_t id, uint32_t member, uint32_t decoration) const;
+    uint32_t typeSize(uint32_t id) const;
+    VkFormat inputFormat(uint32_t id) const;
+};
+
+VkShaderStageFlagBits stageFromModel(uint32_t model) {
+    switch (model) {
+    case spv::Vertex: return VK_SHADER_STAGE_VERTEX_BIT;
+    case spv::TessellationControl: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+    case spv::TessellationEvaluation: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+    case spv::Geometry: return VK_SHADER_STAGE_GEOMETRY_BIT;
+    case spv::Fragment: return VK_SHADER_STAGE_FRAGMENT_BIT;
+    case spv::GLCompute: return VK_SHADER_STAGE_COMPUTE_BIT;
+    default:
+        throw std::runtime_error("unsupported SPIR-V execution model!");
+    }
+}
+
+SpirvModule::SpirvModule(const uint32_t *words, size_t count) {
+    if (count < 5 || words[0] != spv::MagicNumber) {
+        throw std::runtime_error("invalid SPIR-V module!");
+    }
+
+    size_t i = 5;
+    while (i < count) {
+        uint32_t op = words[i] & 0xffff;
+        uint32_t length = words[i] >> 16;
+        if (length == 0 || i + length > count) {
+            throw std::runtime_error("truncated SPIR-V module!");
+        }
+        const uint32_t *arg = words + i + 1;
+
+        switch (op) {
+        case spv::OpEntryPoint:
+            stage = stageFromModel(arg[0]);
+            break;
+        case spv::OpTypeBool:
+            types[arg[0]].op = op;
+            break;
+        case spv::OpTypeInt:
+            types[arg[0]].op = op;
+            types[arg[0]].width = arg[1];
+            types[arg[0]].signedness = arg[2];
+            break;
+        case spv::OpTypeFloat:
+            types[arg[0]].op = op;
+            types[arg[0]].width = arg[1];
+            break;
+        case spv::OpTypeVector:
+        case spv::OpTypeMatrix:
+            types[arg[0]].op = op;
+            types[arg[0]].element = arg[1];
+            types[arg[0]].count = arg[2];
+            break;
+        case spv::OpTypeImage:
+            types[arg[0]].op = op;
+            types[arg[0]].sampled = arg[6];
+            break;
+        case spv::OpTypeSampler:
+            types[arg[0]].op = op;
+            break;
+        case spv::OpTypeSampledImage:
+        case spv::OpTypeRuntimeArray:
+            types[arg[0]].op = op;
+            types[arg[0]].element = arg[1];
+            break;
+        case spv::OpTypeArray:
+            types[arg[0]].op = op;
+            types[arg[0]].element = arg[1];
+            types[arg[0]].count = arg[2];
+            break;
+        case spv::OpTypeStruct:
+            types[arg[0]].op = op;
+            types[arg[0]].members.assign(arg + 1, arg + length - 1);
+            break;
+        case spv::OpTypePointer:
+            types[arg[0]].op = op;
+            types[arg[0]].storage = arg[1];
+            types[arg[0]].element = arg[2];
+            break;
+        case spv::OpConstant:
+            constants[arg[1]] = arg[2];
+            break;
+        case spv::OpSpecConstantTrue:
+        case spv::OpSpecConstantFalse:
+        case spv::OpSpecConstant:
+            specConstants[arg[1]] = arg[0];
+            break;
+        case spv::OpVariable:
+            variables[arg[1]] = {arg[0], arg[2]};
+            break;
+        case spv::OpDecorate:
+            decorations[arg[0]][arg[1]] = length > 3 ? arg[2] : 0;
+            break;
+        case spv::OpMemberDecorate:
+            memberDecorations[arg[0]][arg[1]][arg[2]] = length > 4 ? arg[3] : 0;
+            break;
+        }
+        i += length;
+    }
+}
+
+bool SpirvModule::decorated(uint32_t id, uint32_t decoration) const {
+    auto it = decorations.find(id);
+    return it != decorations.end() && it->second.count(decoration) > 0;
+}
+
+uint32_t SpirvModule::decoration(uint32_t id, uint32_t decoration) const {
+    auto it = decorations.find(id);
+    if (it == decorations.end() || it->second.count(decoration) == 0) {
+        return 0;
+    }
+    return it->second.at(decoration);
+}
+
+uint32_t SpirvModule::memberDecoration(uint32_t id, uint32_t member,
+                                       uint32_t decoration) const
+{
+    auto it = memberDecorations.find(id);
+    if (it == memberDecorations.end() || it->second.count(member) == 0) {
+        return 0;
+    }
+    const auto& members = it->second.at(member);
+    auto dec = members.find(decoration);
+    return dec == members.end() ? 0 : dec->second;
+}
+
+uint32_t SpirvModule::typeSize(uint32_t id) const {
+    const SpirvType& type = types.at(id);
+    switch (type.op) {
+    case spv::OpTypeBool:
+        return 4;
+    case spv::OpTypeInt:
+    case spv::OpTypeFloat:
+        return type.width / 8;
+    case spv::OpTypeVector:
+        return type.count * typeSize(type.element);
+    case spv::OpTypeMatrix:
+        return type.count * typeSize(type.element);
+    case spv::OpTypeArray: {
+        uint32_t stride = decoration(id, spv::ArrayStride);
+        if (stride == 0) {
+            stride = typeSize(type.element);
+        }
+        return constants.at(type.count) * stride;
+    }
+    case spv::OpTypeStruct: {
+        uint32_t size = 0;
+        for (uint32_t m = 0; m < type.members.size(); m++) {
+            uint32_t memberSize = typeSize(type.members[m]);
+            const SpirvType& member = types.at(type.members[m]);
+            uint32_t matrixStride = memberDecoration(id, m, spv::MatrixStride);
+            if (member.op == spv::OpTypeMatrix && matrixStride != 0) {
+                memberSize = member.count * matrixStride;
+            }
+            size = std::max(size, memberDecoration(id, m, spv::Offset) + memberSize);
+        }
+        return size;
+    }
+    default:
+        throw std::runtime_error("cannot size opaque SPIR-V type!");
+    }
+}
+
+VkFormat SpirvModule::inputFormat(uint32_t id) const {
+    const SpirvType *type = &types.at(id);
+    uint32_t components = 1;
+    if (type->op == spv::OpTypeVector) {
+        components = type->count;
+        type = &types.at(type->element);
+    }
+    if (type->width != 32 || components > 4) {
+        throw std::runtime_error("unsupported vertex input type!");
+    }
+
+    static const VkFormat floats[] = {
+        VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT,
+        VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT
+    };
+    static const VkFormat sints[] = {
+        VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT,
+        VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT
+    };
+    static const VkFormat uints[] = {
+        VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT,
+        VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT
+    };
+    if (type->op == spv::OpTypeFloat) {
+        return floats[components - 1];
+    }
+    return type->signedness ? sints[components - 1] : uints[components - 1];
+}
+
+}
+
+ShaderReflection ShaderReflection::parse(const uint32_t *words, size_t count) {
+    SpirvModule module(words, count);
+
+    ShaderReflection reflection;
+    reflection.stage = module.stage;
+
+    for (const auto& entry : module.variables) {
+        uint32_t id = entry.first;
+        const SpirvVariable& variable = entry.second;
+        const SpirvType& pointer = module.types.at(variable.type);
+        uint32_t typeId = pointer.element;
+
+        if (variable.storage == spv::PushConstant) {
+            VkPushConstantRange range = {};
+            range.stageFlags = module.stage;
+            range.offset = 0;
+            range.size = module.typeSize(typeId);
+            reflection.pushConstants.push_back(range);
+            continue;
+        }
+
+        if (variable.storage == spv::Input) {
+            if (module.stage != VK_SHADER_STAGE_VERTEX_BIT
+                || module.decorated(id, spv::BuiltIn)
+                || !module.decorated(id, spv::Location)) {
+                continue;
+            }
+            VkVertexInputAttributeDescription input = {};
+            input.location = module.decoration(id, spv::Location);
+            input.format = module.inputFormat(typeId);
+            reflection.inputs.push_back(input);
+            continue;
+        }
+
+        if (variable.storage != spv::Uniform
+            && variable.storage != spv::UniformConstant
+            && variable.storage != spv::StorageBuffer) {
+            continue;
+        }
+
+        VkDescriptorSetLayoutBinding binding = {};
+        binding.binding = module.decoration(id, spv::Binding);
+        binding.descriptorCount = 1;
+        binding.stageFlags = module.stage;
+
+        const SpirvType *type = &module.types.at(typeId);
+        if (type->op == spv::OpTypeArray) {
+            binding.descriptorCount = module.constants.at(type->count);
+            typeId = type->element;
+            type = &module.types.at(typeId);
+        }
+
+        switch (type->op) {
+        case spv::OpTypeSampledImage:
+            binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            break;
+        case spv::OpTypeSampler:
+            binding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+            break;
+        case spv::OpTypeImage:
+            binding.descriptorType = type->sampled == 2
+                ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+                : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+            break;
+        case spv::OpTypeStruct:
+            if (variable.storage == spv::StorageBuffer
+                || module.decorated(typeId, spv::BufferBlock)) {
+                binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            } else {
+                binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            }
+            break;
+        default:
+            throw std::runtime_error("unsupported SPIR-V resource type!");
+        }
+
+        reflection.bindings.push_back({module.decoration(id, spv::DescriptorSet), binding});
+    }
+
+    for (const auto& entry : module.specConstants) {
+        if (!module.decorated(entry.first, spv::SpecId)) {
+            continue;
+        }
+        ReflectedSpecConstant constant;
+        constant.id = module.decoration(entry.first, spv::SpecId);
+        constant.size = module.typeSize(entry.second);
+        reflection.specConstants.push_back(constant);
+    }
+
+    std::sort(reflection.inputs.begin(), reflection.inputs.end(),
+              [](const VkVertexInputAttributeDescription& a,
+                 const VkVertexInputAttributeDescription& b) {
+                  return a.location < b.location;
+              });
+    return reflection;
+}
@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include "vk.h"
+
+// Below this many draws the sort stays on the calling thread; handing
+// chunks to the job system costs more than the sort itself.
+static const size_t parallelThreshold = 16384;
+
+// LSD radix sort of keys, moving values along, 8 bits per pass. Passes in
+// which every key has the same digit are skipped, which is most of them
+// when only a few pipelines and materials are in use. With several chunks
+// each pass builds per-chunk histograms in parallel, scans them serially in
+// (digit, chunk) order and scatters each chunk in parallel, so the sort
+// stays stable.
+static void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values,
+                      std::vector<uint64_t>& keyScratch, std::vector<uint32_t>& valueScratch,
+                      unsigned threads)
+{
+    size_t n = keys.size();
+    if (n < parallelThreshold) {
+        threads = 1;
+    }
+    threads = std::max(1u, threads);
+    size_t chunk = (n + threads - 1) / threads;
+    keyScratch.resize(n);
+    valueScratch.resize(n);
+    std::vector<std::array<size_t, 256>> offsets(threads);
+
+    auto forEachChunk = [&](const std::function<void(unsigned, size_t, size_t)>& work) {
+        JobSystem::get().parallelFor(threads, 1, [&](size_t first, size_t last) {
+            for (size_t t = first; t < last; t++) {
+                work(t, std::min(n, t * chunk), std::min(n, (t + 1) * chunk));
+            }
+        });
+    };
+
+    for (uint32_t shift = 0; shift < 64; shift += 8) {
+        forEachChunk([&](unsigned t, size_t begin, size_t end) {
+            offsets[t].fill(0);
+            for (size_t i = begin; i < end; i++) {
+                offsets[t][(keys[i] >> shift) & 0xff]++;
+            }
+        });
+
+        bool sorted = false;
+        size_t sum = 0;
+        for (uint32_t digit = 0; digit < 256; digit++) {
+            size_t total = 0;
+            for (unsigned t = 0; t < threads; t++) {
+                total += offsets[t][digit];
+            }
+            if (total == n) {
+                sorted = true;
+                break;
+            }
+            for (unsigned t = 0; t < threads; t++) {
+                size_t count = offsets[t][digit];
+                offsets[t][digit] = sum;
+                sum += count;
+            }
+        }
+        if (sorted) {
+            continue;
+        }
+
+        forEachChunk([&](unsigned t, size_t begin, size_t end) {
+            auto& offset = offsets[t];
+            for (size_t i = begin; i < end; i++) {
+                size_t slot = offset[(keys[i] >> shift) & 0xff]++;
+                keyScratch[slot] = keys[i];
+                valueScratch[slot] = values[i];
+            }
+        });
+        keys.swap(keyScratch);
+        values.swap(valueScratch);
+    }
+}
+
+RenderQueue::RenderQueue(unsigned threads)
+: threads(threads)
+{
+}
+
+// Bits 63-60 pass, 59-44 pipeline, 43-28 material, 27-0 depth. depth is
+// clamped to [0, 1]; passes drawn back to front should pass 1 - depth.
+uint64_t RenderQueue::makeKey(uint32_t pass, uint32_t pipeline, uint32_t material, float depth) {
+    const uint32_t depthMax = (1 << 28) - 1;
+    uint64_t depthBits = (uint64_t) (std::min(std::max(depth, 0.0f), 1.0f) * depthMax);
+    return ((uint64_t) (pass & 0xf) << 60)
+        | ((uint64_t) (pipeline & 0xffff) << 44)
+        | ((uint64_t) (material & 0xffff) << 28)
+        | depthBits;
+}
+
+void RenderQueue::submit(uint64_t key, const DrawItem& item) {
+    keys.push_back(key);
+    order.push_back(items.size());
+    items.push_back(item);
+}
+
+void RenderQueue::clear() {
+    keys.clear();
+    order.clear();
+    items.clear();
+}
+
+void RenderQueue::sort() {
+    TRACE_SCOPE("sort draws");
+    radixSort(keys, order, keyScratch, orderScratch, threads);
+}
+
+RenderQueue::Stats RenderQueue::record(VkCommandBuffer commandBuffer, QueryProfiler *queries) const {
+    return record(commandBuffer, 0, order.size(), queries);
+}
+
+// Records sorted draws [begin, end), binding only what differs from the
+// previous draw; the first draw binds everything. Descriptor sets are also
+// rebound after a pipeline layout change, since sets bound with another
+// layout may no longer be compatible. Disjoint ranges may be recorded from
+// different threads into different command buffers.
+RenderQueue::Stats RenderQueue::record(VkCommandBuffer commandBuffer, size_t begin, size_t end,
+                                       QueryProfiler *queries) const
+{
+    Stats stats;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    uint32_t vertexBufferCount = 0;
+    VkBuffer vertexBuffers[2] = {};
+    VkDeviceSize vertexOffsets[2] = {};
+    VkBuffer indexBuffer = VK_NULL_HANDLE;
+    VkDeviceSize indexOffset = 0;
+
+    for (size_t i = begin; i < end; i++) {
+        const DrawItem& item = items[order[i]];
+
+        if (item.pipeline != pipeline) {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, item.pipeline);
+            pipeline = item.pipeline;
+            stats.binds++;
+        } else {
+            stats.elided++;
+        }
+
+        if (item.descriptorSet != descriptorSet || item.layout != layout) {
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, item.layout,
+                                    0, 1, &item.descriptorSet, 0, nullptr);
+            descriptorSet = item.descriptorSet;
+            layout = item.layout;
+            stats.binds++;
+        } else {
+            stats.elided++;
+        }
+
+        if (item.vertexBufferCount != vertexBufferCount
+            || memcmp(item.vertexBuffers, vertexBuffers, sizeof(VkBuffer) * vertexBufferCount) != 0
+            || memcmp(item.vertexOffsets, vertexOffsets, sizeof(VkDeviceSize) * vertexBufferCount) != 0)
+        {
+            vkCmdBindVertexBuffers(commandBuffer, 0, item.vertexBufferCount,
+                                   item.vertexBuffers, item.vertexOffsets);
+            vertexBufferCount = item.vertexBufferCount;
+            std::copy(item.vertexBuffers, item.vertexBuffers + 2, vertexBuffers);
+            std::copy(item.vertexOffsets, item.vertexOffsets + 2, vertexOffsets);
+            stats.binds++;
+        } else {
+            stats.elided++;
+        }
+
+        if (item.indexBuffer != indexBuffer || item.indexOffset != indexOffset) {
+            vkCmdBindIndexBuffer(commandBuffer, item.indexBuffer, item.indexOffset,
+                                 VK_INDEX_TYPE_UINT32);
+            indexBuffer = item.indexBuffer;
+            indexOffset = item.indexOffset;
+            stats.binds++;
+        } else {
+            stats.elided++;
+        }
+
+        if (item.pushConstantSize) {
+            vkCmdPushConstants(commandBuffer, item.layout, item.pushStages, 0,
+                               item.pushConstantSize, item.pushConstants);
+        }
+
+        QueryScope drawQuery(queries, commandBuffer, item.name, QueryProfiler::PER_DRAW);
+        vkCmdDrawIndexed(commandBuffer, item.indexCount, item.instanceCount,
+                         item.firstIndex, item.vertexOffset, item.firstInstance);
+        stats.draws++;
+    }
+    return stats;
+}
@@ -1,39 +1,100 @@
+#include <sys/inotify.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 class Shader {
 public:
     Shader(shared_ptr<Device> deviceptr, const std::string& filename,
+           const uint32_t *code, size_t wordCount,
            VkShaderStageFlagBits stageFlags);
     ~Shader();
     operator VkShaderModule() { return module; }
+    const ShaderReflection& reflection() const { return reflected; }
+    const std::string& path() const { return filename; }
+    uint32_t featureMask() const { return features; }
+    VkPipelineShaderStageCreateInfo stageInfo(uint32_t features = 0);
 
 private:
+    struct Variant {
+        std::vector<VkSpecializationMapEntry> entries;
+        std::vector<uint32_t> data;
+        VkSpecializationInfo info;
+    };
+
     shared_ptr<Device> deviceptr;
     Device device;
+    std::string filename;
     VkShaderModule module;
     VkShaderStageFlagBits stageFlags;
-    VkPipeLineShaderStageCreateInfo stageInfo();
-};
+    ShaderReflection reflected;
+    uint32_t features = 0;
+    std::mutex variantMutex;
+    std::map<uint32_t, Variant> variants;
 
-class VertexShader: Shader {
-public:
-    VertexShader(shared_ptr<Device> deviceptr, const std::string& filename)
-    : Shader(deviceptr, filename, VK_SHADER_STAGE_VERTEX_BIT) {}
+    const VkSpecializationInfo *specialization(uint32_t features);
 };
 
-class FragmentShader: Shader {
+// SPIR-V mapped straight from disk; mmap returns page aligned memory, so the
+// words can be handed to vkCreateShaderModule without copying.
+class SpirvFile {
 public:
-    VertexShader(shared_ptr<Device> deviceptr, const std::string& filename)
-    : Shader(deviceptr, filename, VK_SHADER_STAGE_FRAGMENT_BIT) {}
+    SpirvFile(const std::string& filename);
+    ~SpirvFile();
+    const uint32_t *words() const { return (const uint32_t*) data; }
+    size_t wordCount() const { return size / sizeof(uint32_t); }
+
+private:
+    void *data = MAP_FAILED;
+    size_t size = 0;
 };
 
+SpirvFile::SpirvFile(const std::string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("failed to open file " + filename);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size % sizeof(uint32_t) != 0) {
+        close(fd);
+        throw std::runtime_error("invalid SPIR-V file " + filename);
+    }
+    size = st.st_size;
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("failed to map file " + filename);
+    }
+}
+
+SpirvFile::~SpirvFile() {
+    if (data != MAP_FAILED) {
+        munmap(data, size);
+    }
+}
+
 Shader::Shader(shared_ptr<Device> deviceptr, const std::string& filename,
+               const uint32_t *code, size_t wordCount,
                VkShaderStageFlagBits stageFlags)
-: deviceptr(deviceptr), device(*deviceptr.get()), stageFlags(stageFlags)
+: deviceptr(deviceptr), device(*deviceptr.get()), filename(filename),
+  stageFlags(stageFlags)
 {
-    auto code = readFile(filename);
+    reflected = ShaderReflection::parse(code, wordCount);
+    if (reflected.stage != stageFlags) {
+        throw std::runtime_error("shader stage does not match " + filename);
+    }
+    for (const auto& constant : reflected.specConstants) {
+        if (constant.id < 32) {
+            features |= 1u << constant.id;
+        }
+    }
+
     VkShaderModuleCreateInfo info = {};
     info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    info.codeSize = code.size();
-    info.pCode = (uint32_t*) code.data();
+    info.codeSize = wordCount * sizeof(uint32_t);
+    info.pCode = code;
 
     auto res = vkCreateShaderModule(device, &info, nullptr, &module);
     if (res != VK_SUCCESS) {
@@ -42,27 +103,159 @@ Shader::Shader(shared_ptr<Device> deviceptr, const std::string& filename,
 }
 
 Shader::~Shader() {
-    vkDestroyShaderModule(device, module);
+    vkDestroyShaderModule(device, module, nullptr);
 }
 
-static std::vector<char> Shader::readFile(const std::string& filename) {
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
-    if (!file.is_open()) {
-        throw std::runtime_error("failed to open file!");
-    }
-    size_t fileSize = (size_t) file.tellg();
-    std::vector<char> buffer(fileSize);
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
-    file.close();
-    return buffer;
+// Variants are keyed by the feature bits this shader actually declares, so
+// masks differing only in bits it ignores share one specialization.
+const VkSpecializationInfo *Shader::specialization(uint32_t requested) {
+    if (features == 0) {
+        return nullptr;
+    }
+    uint32_t key = requested & features;
+
+    std::lock_guard<std::mutex> lock(variantMutex);
+    auto it = variants.find(key);
+    if (it != variants.end()) {
+        return &it->second.info;
+    }
+
+    Variant& variant = variants[key];
+    for (const auto& constant : reflected.specConstants) {
+        if (constant.id >= 32 || constant.size != sizeof(VkBool32)) {
+            continue;
+        }
+        VkSpecializationMapEntry entry = {};
+        entry.constantID = constant.id;
+        entry.offset = variant.data.size() * sizeof(uint32_t);
+        entry.size = sizeof(VkBool32);
+        variant.entries.push_back(entry);
+        variant.data.push_back((key >> constant.id) & 1 ? VK_TRUE : VK_FALSE);
+    }
+
+    variant.info.mapEntryCount = variant.entries.size();
+    variant.info.pMapEntries = variant.entries.data();
+    variant.info.dataSize = variant.data.size() * sizeof(uint32_t);
+    variant.info.pData = variant.data.data();
+    return &variant.info;
 }
 
-VkPipeLineShaderStageCreateInfo Shader::stageInfo() {
+VkPipelineShaderStageCreateInfo Shader::stageInfo(uint32_t features) {
     VkPipelineShaderStageCreateInfo info = {};
     info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    info.stage = stageInfo;
+    info.stage = stageFlags;
     info.module = module;
     info.pName = "main";
+    info.pSpecializationInfo = specialization(features);
     return info;
 }
+
+static uint64_t hashWords(const uint32_t *words, size_t count) {
+    uint64_t hash = 14695981039346656037ull;
+    const unsigned char *bytes = (const unsigned char*) words;
+    for (size_t i = 0; i < count * sizeof(uint32_t); i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+ShaderCache::ShaderCache(std::shared_ptr<Device> deviceptr)
+: deviceptr(deviceptr)
+{
+}
+
+std::shared_ptr<Shader> ShaderCache::create(const std::string& filename,
+                                            VkShaderStageFlagBits stage,
+                                            Entry& entry)
+{
+    SpirvFile file(filename);
+    entry.hash = hashWords(file.words(), file.wordCount());
+    entry.stage = stage;
+
+    auto shader = modules[entry.hash].lock();
+    if (!shader) {
+        shader = std::make_shared<Shader>(deviceptr, filename, file.words(),
+                                          file.wordCount(), stage);
+        modules[entry.hash] = shader;
+    }
+    entry.shader = shader;
+    return shader;
+}
+
+std::shared_ptr<Shader> ShaderCache::load(const std::string& filename,
+                                          VkShaderStageFlagBits stage)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = files.find(filename);
+    if (it != files.end() && it->second.stage == stage) {
+        return it->second.shader;
+    }
+    return create(filename, stage, files[filename]);
+}
+
+bool ShaderCache::reload(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = files.find(filename);
+    if (it == files.end()) {
+        return false;
+    }
+    uint64_t previous = it->second.hash;
+    create(filename, it->second.stage, it->second);
+    return it->second.hash != previous;
+}
+
+ShaderWatcher::ShaderWatcher(ShaderCache& cache, const std::string& directory)
+: cache(cache), directory(directory), running(true)
+{
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        throw std::runtime_error("failed to initialize inotify!");
+    }
+    if (inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(inotifyFd);
+        throw std::runtime_error("failed to watch " + directory);
+    }
+    thread = std::thread(&ShaderWatcher::run, this);
+}
+
+ShaderWatcher::~ShaderWatcher() {
+    running = false;
+    thread.join();
+    close(inotifyFd);
+}
+
+void ShaderWatcher::run() {
+    alignas(struct inotify_event) char buffer[4096];
+    pollfd fds = {inotifyFd, POLLIN, 0};
+
+    while (running) {
+        if (poll(&fds, 1, 100) <= 0) {
+            continue;
+        }
+        ssize_t len = read(inotifyFd, buffer, sizeof(buffer));
+        for (ssize_t i = 0; i < len; ) {
+            auto *event = (struct inotify_event*) (buffer + i);
+            std::string name(event->len ? event->name : "");
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".spv") == 0) {
+                reload(directory + "/" + name);
+            }
+            i += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+// Files the cache never loaded are ignored, as are writes that leave the
+// contents unchanged.
+void ShaderWatcher::reload(const std::string& filename) {
+    try {
+        if (cache.reload(filename)) {
+            std::cout << "reloaded " << filename << std::endl;
+            reloaded = true;
+        }
+    } catch (const std::runtime_error& e) {
+        std::cerr << "shader reload: " << e.what() << std::endl;
+    }
+}
@@ -8,6 +8,20 @@ layout(location = 0) out vec4 outColor;
 
 layout(binding = 1) uniform sampler2D texSampler;
 
+layout(constant_id = 0) const bool HAS_TEXTURE = true;
+layout(constant_id = 1) const bool ALPHA_TEST = false;
+layout(constant_id = 2) const bool VERTEX_COLOR = false;
+
 void main() {
-    outColor = texture(texSampler, fragTexCoord);
+    vec4 color = vec4(1.0);
+    if (HAS_TEXTURE) {
+        color = texture(texSampler, fragTexCoord);
+    }
+    if (VERTEX_COLOR) {
+        color.rgb *= fragColor;
+    }
+    if (ALPHA_TEST && color.a < 0.5) {
+        discard;
+    }
+    outColor = color;
 }
@@ -1,3 +1,5 @@
+#include "vk.h"
+
 Texture::Texture(std::shared_ptr<Device> deviceptr, const string& path)
 : deviceptr(deviceptr), device(*deviceptr.get()),
   image(texWidth, texHeight, deviceptr
@@ -10,18 +12,37 @@ Texture::Texture(std::shared_ptr<Device> deviceptr, const string& path)
     int height;
     int channels;
 
-    stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &width, &height,
-                                &texChannels, STBI_rgb_alpha);
+    TRACE_SCOPE("load texture");
+    // The sampler does not depend on the pixels, so it is created while a
+    // worker decodes them.
+    stbi_uc* pixels = nullptr;
+    auto decode = JobSystem::get().spawn([&] {
+        TRACE_SCOPE("decode texture");
+        pixels = stbi_load(TEXTURE_PATH.c_str(), &width, &height,
+                           &texChannels, STBI_rgb_alpha);
+    });
+    // The job writes to this frame, so it must finish before any unwind.
+    std::exception_ptr error;
+    try {
+        createTextureSampler();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    JobSystem::get().wait(decode);
+    if (error) {
+        stbi_image_free(pixels);
+        std::rethrow_exception(error);
+    }
     VkDeviceSize imageSize = width * height * 4;
     if (!pixels) {
         throw std::runtime_error("failed to load texture image!");
     }
 
-    VDeleter<VkDeviceMemory> stagingImageMemory{device, vkFreeMemory};
     Image stagingImage(texWidth, texHeight, deviceptr,
                        VK_FORMAT_R8G8B8A8_UNORM,
                        VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                       MEMORY_STAGING);
     stagingImage.loadPixels(width, height, pixels);
 
     stbi_image_free(pixels);
@@ -30,8 +51,6 @@ Texture::Texture(std::shared_ptr<Device> deviceptr, const string& path)
     transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
     copyImage(stagingImage, textureImage, texWidth, texHeight);
     transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-    createTextureSampler();
 }
 
 Texture::~Texture() {
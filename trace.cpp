@@ -0,0 +1,81 @@
+#ifdef VK_TRACE
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "trace.h"
+
+namespace trace {
+
+// Each thread writes only to its own ring, so recording takes no lock; the
+// registry mutex is taken once per thread and by dump(). Events still being
+// written while dumping may be torn, which is acceptable for a debug trace.
+static const size_t ringSize = 1 << 16;
+
+struct Ring {
+    uint32_t tid;
+    std::atomic<uint64_t> head{0};
+    Event events[ringSize];
+};
+
+static std::mutex registryMutex;
+static std::vector<std::unique_ptr<Ring>> rings;
+
+static Ring *threadRing() {
+    thread_local Ring *ring = nullptr;
+    if (!ring) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        rings.emplace_back(new Ring());
+        ring = rings.back().get();
+        ring->tid = rings.size() - 1;
+    }
+    return ring;
+}
+
+void record(const char *name, uint64_t start, uint64_t end) {
+    Ring *ring = threadRing();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    ring->events[head % ringSize] = {name, start, end};
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+bool dump(const std::string& filename) {
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    uint64_t origin = UINT64_MAX;
+    for (const auto& ring : rings) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > ringSize ? head - ringSize : 0;
+        for (uint64_t i = first; i < head; i++) {
+            origin = std::min(origin, ring->events[i % ringSize].start);
+        }
+    }
+
+    out << "{\"traceEvents\":[";
+    bool comma = false;
+    for (const auto& ring : rings) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > ringSize ? head - ringSize : 0;
+        for (uint64_t i = first; i < head; i++) {
+            const Event& event = ring->events[i % ringSize];
+            out << (comma ? ",\n" : "\n")
+                << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":0"
+                << ",\"tid\":" << ring->tid
+                << ",\"ts\":" << (event.start - origin) / 1000.0
+                << ",\"dur\":" << (event.end - event.start) / 1000.0 << "}";
+            comma = true;
+        }
+    }
+    out << "\n]}\n";
+    return true;
+}
+
+}
+
+#endif
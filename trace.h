@@ -0,0 +1,54 @@
+#ifndef __TRACE_H_INCLUDED
+#define __TRACE_H_INCLUDED
+
+// Scoped CPU tracing, exported as Chrome trace-event JSON (chrome://tracing).
+// Build with `make TRACE=1` to enable; otherwise the macros expand to nothing.
+
+#ifdef VK_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace trace {
+
+struct Event {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+};
+
+inline uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void record(const char *name, uint64_t start, uint64_t end);
+bool dump(const std::string& filename);
+
+class Scope {
+public:
+    Scope(const char *name) : name(name), start(now()) {}
+    ~Scope() { record(name, start, now()); }
+
+private:
+    const char *name;
+    uint64_t start;
+};
+
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_DUMP(filename) trace::dump(filename)
+
+#else
+
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_DUMP(filename) do {} while (0)
+
+#endif
+
+#endif
@@ -1,17 +1,26 @@
+#include <algorithm>
 #include <vk.h>
 
-VkVertexInputBindingDescription Vertex::getBindingDescription() {
-    VkVertexInputBindingDescription bindingDescription = {};
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(Vertex);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-    return bindingDescription;
+// Binding 0 advances per vertex. Instanced pipelines add binding 1, which
+// advances once per instance and carries InstanceData.
+std::vector<VkVertexInputBindingDescription> Vertex::getBindingDescriptions(bool instanced) {
+    std::vector<VkVertexInputBindingDescription> bindings(instanced ? 2 : 1);
+    bindings[0].binding = 0;
+    bindings[0].stride = sizeof(Vertex);
+    bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    if (instanced) {
+        bindings[1].binding = 1;
+        bindings[1].stride = sizeof(InstanceData);
+        bindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+    }
+    return bindings;
 }
 
 
-std::array<VkVertexInputAttributeDescription, 3> Vertex::getAttributeDescriptions()
+std::vector<VkVertexInputAttributeDescription> Vertex::getAttributeDescriptions(bool instanced)
 {
-    std::array<VkVertexInputAttributeDescription, 3> description = {};
+    std::vector<VkVertexInputAttributeDescription> description(3);
     description[0].binding = 0;
     description[0].location = 0;
     description[0].format = VK_FORMAT_R32G32B32_SFLOAT;
@@ -27,9 +36,39 @@ std::array<VkVertexInputAttributeDescription, 3> Vertex::getAttributeDescription
     description[2].format = VK_FORMAT_R32G32_SFLOAT;
     description[2].offset = offsetof(Vertex, texCoord);
 
+    // A mat4 attribute takes one location per column.
+    if (instanced) {
+        for (uint32_t column = 0; column < 4; column++) {
+            VkVertexInputAttributeDescription attribute = {};
+            attribute.binding = 1;
+            attribute.location = INSTANCE_LOCATION + column;
+            attribute.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+            attribute.offset = offsetof(InstanceData, model) + column * sizeof(glm::vec4);
+            description.push_back(attribute);
+        }
+    }
+
     return description;
 }
 
 bool Vertex::operator==(const Vertex& other) const {
     return pos == other.pos && color == other.color && texCoord == other.texCoord;
 }
+
+glm::vec4 boundingSphere(const std::vector<Vertex>& vertices) {
+    if (vertices.empty()) {
+        return glm::vec4(0.0f);
+    }
+    glm::vec3 low = vertices[0].pos;
+    glm::vec3 high = vertices[0].pos;
+    for (const auto& vertex : vertices) {
+        low = glm::min(low, vertex.pos);
+        high = glm::max(high, vertex.pos);
+    }
+    glm::vec3 center = (low + high) * 0.5f;
+    float radius = 0.0f;
+    for (const auto& vertex : vertices) {
+        radius = std::max(radius, glm::length(vertex.pos - center));
+    }
+    return glm::vec4(center, radius);
+}
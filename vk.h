@@ -5,53 +5,146 @@
 #include <string>
 #include <iostream>
 #include <memory>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
 #include <GLFW/glfw3.h>
 #include <vulkan/vulkan.h>
 #include <glm/glm.hpp>
 #include <glm/gtx/hash.hpp>
+#include "trace.h"
+#include "jobs.h"
 
 struct QueueFamilyIndices {
     int graphicsFamily = -1;
     int presentFamily = -1;
+    // A compute-only family when the device has one, else graphicsFamily.
+    int computeFamily = -1;
 
     bool isComplete() {
         return graphicsFamily >= 0 && presentFamily >= 0;
     }
 };
 
+enum ValidationLevel {
+    VALIDATION_OFF,
+    VALIDATION_CORE,
+    VALIDATION_SYNC,
+    VALIDATION_BEST_PRACTICES,
+};
+
+// Debug settings chosen at startup from --validation=<level> / VK_VALIDATION
+// and --benchmark=<frames> / VK_BENCHMARK. Release builds (NDEBUG) always
+// run with validation off and have the debug messenger compiled out.
+struct DebugConfig {
+    ValidationLevel validation;
+    uint32_t benchmarkFrames = 0;
+
+    bool validationEnabled() const { return validation != VALIDATION_OFF; }
+    const std::vector<const char*>& layers() const;
+    const char *levelName() const;
+
+    static void parse(int argc, char **argv);
+    static const DebugConfig& get();
+};
+
+// VK_EXT_debug_utils object names and command buffer labels. These are
+// no-ops unless validation is on, and vanish entirely from release builds.
+namespace debug {
+#ifdef NDEBUG
+inline void load(VkInstance) {}
+inline void setName(VkDevice, VkObjectType, uint64_t, const char*) {}
+inline void beginLabel(VkCommandBuffer, const char*) {}
+inline void endLabel(VkCommandBuffer) {}
+#else
+void load(VkInstance instance);
+void setName(VkDevice device, VkObjectType type, uint64_t handle, const char *name);
+void beginLabel(VkCommandBuffer commandBuffer, const char *name);
+void endLabel(VkCommandBuffer commandBuffer);
+#endif
+}
+
 class Instance {
 public:
     Instance(const std::string& name);
     ~Instance();
 private:
     VkInstance _instance;
-    VkDebugReportCallbackEXT _reportCallback;
     VkSurfaceKHR surface;
 
     void createInstance(const std::string& name);
     std::vector<const char*> getRequiredExtensions();
     void checkExtensions();
     void checkValidationLayers();
-    VkResult CreateDebugReportCallbackEXT(
-            const VkDebugReportCallbackCreateInfoEXT* pCreateInfo,
-            const VkAllocationCallbacks* pAllocator,
-            VkDebugReportCallbackEXT* pCallback) ;
-    void DestroyDebugReportCallbackEXT(
-            VkDebugReportCallbackEXT callback,
-            const VkAllocationCallbacks* pAllocator) ;
+#ifndef NDEBUG
+    VkDebugUtilsMessengerEXT messenger = VK_NULL_HANDLE;
+
     static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-            VkDebugReportFlagsEXT flags,
-            VkDebugReportObjectTypeEXT objType,
-            uint64_t obj,
-            size_t location,
-            int32_t code,
-            const char* layerPrefix,
-            const char* msg,
+            VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+            VkDebugUtilsMessageTypeFlagsEXT types,
+            const VkDebugUtilsMessengerCallbackDataEXT* data,
             void* userData);
-    void setupDebugCallback();
+    void setupDebugMessenger();
+#endif
     void createSurface(GLFWwindow *window);
 };
 
+enum MemoryCategory {
+    MEMORY_VERTEX,
+    MEMORY_INDEX,
+    MEMORY_UNIFORM,
+    MEMORY_TEXTURE,
+    MEMORY_DEPTH,
+    MEMORY_STAGING,
+    MEMORY_OTHER,
+    MEMORY_CATEGORY_COUNT
+};
+
+// Accounts every VkDeviceMemory allocation by heap, memory type and
+// category. Shared between copies of Device so all owners see one ledger.
+class MemoryTracker {
+public:
+    MemoryTracker(VkInstance instance, VkPhysicalDevice physical, bool budgetSupported);
+    void allocated(VkDeviceMemory memory, VkDeviceSize size, uint32_t typeIndex,
+                   MemoryCategory category);
+    void freed(VkDeviceMemory memory);
+    void report(std::ostream& out);
+    void dumpJson(std::ostream& out);
+
+private:
+    struct Allocation {
+        VkDeviceSize size;
+        uint32_t typeIndex;
+        MemoryCategory category;
+    };
+
+    struct Usage {
+        VkDeviceSize bytes = 0;
+        VkDeviceSize peak = 0;
+        uint32_t count = 0;
+
+        void add(VkDeviceSize size);
+        void remove(VkDeviceSize size);
+    };
+
+    VkPhysicalDevice physical;
+    VkPhysicalDeviceMemoryProperties properties;
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR getProperties2 = nullptr;
+    std::mutex mutex;
+    std::map<VkDeviceMemory, Allocation> allocations;
+    Usage heaps[VK_MAX_MEMORY_HEAPS];
+    Usage types[VK_MAX_MEMORY_TYPES];
+    Usage categories[MEMORY_CATEGORY_COUNT];
+
+    bool queryBudget(VkDeviceSize *budget, VkDeviceSize *usage);
+};
+
 struct SwapChainSupport;
 
 class Device {
@@ -61,6 +154,21 @@ public:
     VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates,
                                  VkImageTiling tiling, VkFormatFeatureFlags features);
     VkFormat findDepthFormat();
+    bool hasExtension(const char *name);
+    const VkPhysicalDeviceFeatures& features() const { return enabledFeatures; }
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+    VkDeviceMemory allocateMemory(const VkMemoryRequirements& requirements,
+                                  VkMemoryPropertyFlags properties,
+                                  MemoryCategory category);
+    void freeMemory(VkDeviceMemory memory);
+    MemoryTracker& memory() { return *memoryTracker; }
+
+    VkQueue graphics() const { return graphicsQueue; }
+    VkQueue compute() const { return computeQueue; }
+    const QueueFamilyIndices& queueFamilies() const { return families; }
+    std::vector<uint32_t> sharedQueueFamilies() const;
+
+    static void parseSelection(int argc, char **argv);
     operator VkDevice() { return logical; }
     operator VkPhysicalDevice() { return physical; }
 
@@ -69,10 +177,18 @@ private:
     VkDevice logical = VK_NULL_HANDLE;
     VkQueue graphicsQueue;
     VkQueue presentQueue;
+    VkQueue computeQueue;
+    QueueFamilyIndices families;
     VkSurfaceKHR surface;
     VkInstance instance;
+    std::vector<const char*> enabledExtensions;
+    VkPhysicalDeviceFeatures enabledFeatures = {};
+    std::shared_ptr<MemoryTracker> memoryTracker;
+
+    static std::string selection;
 
     void pickPhysicalDevice();
+    int scoreDevice(VkPhysicalDevice device);
     QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
     QueueFamilyIndices findQueueFamilies();
     bool checkDeviceExtensionSupport(VkPhysicalDevice device);
@@ -115,8 +231,14 @@ private:
 
 class CommandPool {
 public:
-    CommandPool(std::shared_ptr<Device> deviceptr);
+    // queueFamily defaults to the graphics family.
+    CommandPool(std::shared_ptr<Device> deviceptr, int queueFamily = -1,
+                VkCommandPoolCreateFlags flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
     ~CommandPool();
+    // Owns the VkCommandPool, so copies would destroy it twice.
+    CommandPool(const CommandPool&) = delete;
+    CommandPool& operator=(const CommandPool&) = delete;
+    void reset();
     operator VkCommandPool() { return pool; }
 
 private:
@@ -125,11 +247,669 @@ private:
     VkCommandPool pool;
 };
 
+// Records work for Device's compute queue. submit() signals a semaphore that
+// the next graphics submission must wait on via takeSemaphore(); a fence
+// keeps the command buffer from being re-recorded while still in flight.
+// Buffers touched by both queues should come from createSharedBuffer(),
+// which shares them concurrently to avoid ownership transfers.
+class AsyncCompute {
+public:
+    AsyncCompute(std::shared_ptr<Device> deviceptr);
+    ~AsyncCompute();
+    VkCommandBuffer begin();
+    void submit();
+    VkSemaphore takeSemaphore();
+    bool dedicatedQueue() const;
+
+private:
+    std::shared_ptr<Device> deviceptr;
+    Device device;
+    CommandPool pool;
+    VkCommandBuffer commandBuffer;
+    VkSemaphore semaphore;
+    VkFence fence;
+    bool signaled = false;
+};
+
+void createSharedBuffer(Device& device, VkDeviceSize size, VkBufferUsageFlags usage,
+                        VkMemoryPropertyFlags properties, MemoryCategory category,
+                        VkBuffer& buffer, VkDeviceMemory& memory);
+
+struct DescriptorPoolRatio {
+    VkDescriptorType type;
+    float ratio;
+};
+
+class DescriptorAllocator {
+public:
+    DescriptorAllocator(std::shared_ptr<Device> deviceptr,
+                        uint32_t setsPerPool = 64,
+                        std::vector<DescriptorPoolRatio> ratios = defaultRatios());
+    ~DescriptorAllocator();
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+    void reset();
+
+    static std::vector<DescriptorPoolRatio> defaultRatios();
+
+private:
+    std::shared_ptr<Device> deviceptr;
+    Device device;
+    std::vector<DescriptorPoolRatio> ratios;
+    uint32_t setsPerPool;
+    VkDescriptorPool current = VK_NULL_HANDLE;
+    std::vector<VkDescriptorPool> usedPools;
+    std::vector<VkDescriptorPool> freePools;
+
+    VkDescriptorPool grabPool();
+    VkDescriptorPool createPool(uint32_t maxSets);
+};
+
+class FrameDescriptorAllocator {
+public:
+    FrameDescriptorAllocator(std::shared_ptr<Device> deviceptr,
+                             uint32_t framesInFlight);
+    void beginFrame(uint32_t frameIndex);
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+
+private:
+    std::vector<std::unique_ptr<DescriptorAllocator>> frames;
+    uint32_t frameIndex = 0;
+};
+
+struct ReflectedBinding {
+    uint32_t set;
+    VkDescriptorSetLayoutBinding binding;
+};
+
+struct ReflectedSpecConstant {
+    uint32_t id;
+    uint32_t size;
+};
+
+struct ShaderReflection {
+    VkShaderStageFlagBits stage;
+    std::vector<ReflectedBinding> bindings;
+    std::vector<VkPushConstantRange> pushConstants;
+    std::vector<VkVertexInputAttributeDescription> inputs;
+    std::vector<ReflectedSpecConstant> specConstants;
+
+    static ShaderReflection parse(const uint32_t *words, size_t count);
+};
+
+struct DescriptorSetLayoutInfo {
+    VkDescriptorSetLayout layout;
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+};
+
+struct PipelineLayoutInfo {
+    VkPipelineLayout layout;
+    std::vector<const DescriptorSetLayoutInfo*> setLayouts;
+    std::vector<VkPushConstantRange> pushConstants;
+};
+
+class LayoutCache {
+public:
+    LayoutCache(std::shared_ptr<Device> deviceptr);
+    ~LayoutCache();
+    const DescriptorSetLayoutInfo& setLayout(
+        std::vector<VkDescriptorSetLayoutBinding> bindings);
+    const PipelineLayoutInfo& pipelineLayout(
+        const std::vector<const ShaderReflection*>& stages);
+
+private:
+    std::shared_ptr<Device> deviceptr;
+    Device device;
+    std::map<std::vector<uint32_t>, DescriptorSetLayoutInfo> setLayouts;
+    std::map<std::vector<uint64_t>, PipelineLayoutInfo> pipelineLayouts;
+    std::recursive_mutex mutex;
+};
+
+class Shader;
+class Pipeline;
+class ComputePipeline;
+
+// Bit N of a feature mask drives the boolean specialization constant with
+// constant_id N in shader.vert/shader.frag.
+enum ShaderFeature : uint32_t {
+    FEATURE_TEXTURE = 1 << 0,
+    FEATURE_ALPHA_TEST = 1 << 1,
+    FEATURE_VERTEX_COLOR = 1 << 2,
+};
+
+class ShaderCache {
+public:
+    ShaderCache(std::shared_ptr<Device> deviceptr);
+    std::shared_ptr<Shader> load(const std::string& filename,
+                                 VkShaderStageFlagBits stage);
+    bool reload(const std::string& filename);
+
+private:
+    struct Entry {
+        uint64_t hash;
+        VkShaderStageFlagBits stage;
+        std::shared_ptr<Shader> shader;
+    };
+
+    std::shared_ptr<Device> deviceptr;
+    std::mutex mutex;
+    std::map<std::string, Entry> files;
+    std::map<uint64_t, std::weak_ptr<Shader>> modules;
+
+    std::shared_ptr<Shader> create(const std::string& filename,
+                                   VkShaderStageFlagBits stage, Entry& entry);
+};
+
+// Reloads changed .spv files into the cache from a background thread. It
+// does not touch pipelines; the renderer polls takeReloaded() between
+// frames and re-resolves its pipeline descriptions through the cache.
+class ShaderWatcher {
+public:
+    ShaderWatcher(ShaderCache& cache, const std::string& directory);
+    ~ShaderWatcher();
+    // True once after any watched file reloaded with new contents.
+    bool takeReloaded() { return reloaded.exchange(false); }
+
+private:
+    ShaderCache& cache;
+    std::string directory;
+    int inotifyFd;
+    std::atomic<bool> running;
+    std::atomic<bool> reloaded{false};
+    std::thread thread;
+
+    void run();
+    void reload(const std::string& filename);
+};
+
+struct PipelineDesc {
+    std::shared_ptr<Shader> vertShader;
+    std::shared_ptr<Shader> fragShader;
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    uint32_t subpass = 0;
+    VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+    VkBool32 depthTest = VK_TRUE;
+    VkBool32 blend = VK_FALSE;
+    // Adds the per-instance vertex binding described by InstanceData.
+    VkBool32 instanced = VK_FALSE;
+    uint32_t features = FEATURE_TEXTURE;
+
+    uint64_t key() const;
+};
+
+// Compiles on its own threads rather than as jobs: a compile can take
+// longer than a frame, and a frame waiting on its jobs would pick it up and
+// stall. Jobs also only run on workers or waiting threads, so with no
+// workers a polled compile would never start.
+class PipelineCompiler {
+public:
+    typedef std::shared_future<std::shared_ptr<Pipeline>> Future;
+
+    PipelineCompiler(std::shared_ptr<Device> deviceptr, LayoutCache& layouts,
+                     const std::string& cacheFile = "pipelines.cache",
+                     unsigned workers = std::thread::hardware_concurrency());
+    ~PipelineCompiler();
+    Future compile(const PipelineDesc& desc);
+    std::shared_ptr<Pipeline> find(const PipelineDesc& desc,
+                                   std::shared_ptr<Pipeline> fallback = nullptr);
+    // Drops every pipeline built against renderPass, waiting for compiles
+    // still using it. Call before the render pass is destroyed and once
+    // no submitted work uses those pipelines.
+    void evict(VkRenderPass renderPass);
+
+private:
+    struct Entry {
+        VkRenderPass renderPass;
+        Future future;
+    };
+
+    std::shared_ptr<Device> deviceptr;
+    Device device;
+    LayoutCache& layouts;
+    std::string cacheFile;
+    VkPipelineCache cache;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::packaged_task<std::shared_ptr<Pipeline>()>> queue;
+    std::map<uint64_t, Entry> pipelines;
+
+    void createCache();
+    void saveCache();
+    void work();
+};
+
+class GpuProfiler {
+public:
+    GpuProfiler(std::shared_ptr<Device> deviceptr, uint32_t framesInFlight,
+                uint32_t maxScopesPerFrame = 32);
+    ~GpuProfiler();
+    void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+    uint32_t begin(VkCommandBuffer commandBuffer, const char *name);
+    void end(VkCommandBuffer commandBuffer, uint32_t scope);
+    void report(std::ostream& out);
+
+private:
+    struct Scope {
+        const char *name;
+        uint32_t query;
+    };
+
+    struct PassStats {
+        std::vector<double> samples;
+        size_t next = 0;
+    };
+
+    std::shared_ptr<Device> deviceptr;
+    Device device;
+    VkQueryPool pool = VK_NULL_HANDLE;
+    uint32_t framesInFlight;
+    uint32_t maxScopes;
+    uint32_t frame = 0;
+    double timestampPeriod;
+    uint64_t timestampMask = ~0ull;
+    std::vector<std::vector<Scope>> scopes;
+    std::map<std::string, PassStats> stats;
+
+    void collect(uint32_t frameIndex);
+};
+
+class GpuScope {
+public:
+    GpuScope(GpuProfiler *profiler, VkCommandBuffer commandBuffer, const char *name)
+    : profiler(profiler), commandBuffer(commandBuffer),
+      scope(profiler ? profiler->begin(commandBuffer, name) : 0) {}
+    ~GpuScope() {
+        if (profiler) {
+            profiler->end(commandBuffer, scope);
+        }
+    }
+
+private:
+    GpuProfiler *profiler;
+    VkCommandBuffer commandBuffer;
+    uint32_t scope;
+};
+
+// Log-linear histogram of microsecond durations: every power of two is split
+// into 32 linear sub-buckets, so quantiles are accurate to about 3%.
+class Histogram {
+public:
+    Histogram();
+    void record(uint64_t value);
+    void merge(const Histogram& other);
+    void clear();
+    uint64_t percentile(double p) const;
+    uint64_t count() const { return total; }
+    uint64_t max() const { return maxValue; }
+
+private:
+    static const uint32_t subBits = 5;
+    std::vector<uint64_t> buckets;
+    uint64_t total = 0;
+    uint64_t maxValue = 0;
+
+    static size_t bucket(uint64_t value);
+    static uint64_t bucketValue(size_t index);
+};
+
+class FrameStats {
+public:
+    enum Metric { FRAME_CPU, ACQUIRE, RECORD, SUBMIT, PRESENT_INTERVAL, METRIC_COUNT };
+    typedef std::chrono::steady_clock Clock;
+
+    FrameStats(bool json = false, double reportSeconds = 1.0);
+    bool json() const { return machineReadable; }
+    void beginFrame();
+    void record(Metric metric, Clock::time_point start);
+    void setBudget(Metric metric, uint64_t micros);
+    void presented();
+    bool endFrame(std::ostream& out);
+    void summary(std::ostream& out);
+    void counter(const std::string& name, uint64_t value);
+
+private:
+    struct Counter {
+        uint64_t sum = 0;
+        uint64_t samples = 0;
+    };
+
+    struct Window {
+        Histogram metrics[METRIC_COUNT];
+        std::map<std::string, Counter> counters;
+        uint64_t overBudget[METRIC_COUNT] = {};
+        uint64_t hitches = 0;
+        Clock::time_point start;
+    };
+
+    bool machineReadable;
+    double reportSeconds;
+    Window window;
+    Window total;
+    uint64_t budgets[METRIC_COUNT] = {};
+    Clock::time_point frameStart;
+    Clock::time_point lastPresent;
+
+    void mergeWindow();
+    void report(std::ostream& out, const Window& stats, const char *type);
+};
+
+// Pipeline statistics and occlusion queries around passes or single draws,
+// fed into FrameStats as counters. Scopes opened at a granularity other than
+// the configured one are ignored, so both levels can stay instrumented.
+class QueryProfiler {
+public:
+    enum Granularity { PER_PASS, PER_DRAW };
+    enum Flags { PIPELINE_STATISTICS = 1 << 0, OCCLUSION = 1 << 1 };
+
+    QueryProfiler(std::shared_ptr<Device> deviceptr, FrameStats& stats,
+                  uint32_t framesInFlight, uint32_t flags, Granularity granularity,
+                  uint32_t maxScopesPerFrame = 64);
+    ~QueryProfiler();
+    void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+    uint32_t begin(VkCommandBuffer commandBuffer, const char *name, Granularity level);
+    void end(VkCommandBuffer commandBuffer, uint32_t scope);
+    bool inherit(VkCommandBufferInheritanceInfo& info) const;
+
+    static uint32_t parse(const char *spec, Granularity& granularity);
+
+private:
+    struct Scope {
+        const char *name;
+        uint32_t query;
+    };
+
+    std::shared_ptr<Device> deviceptr;
+    Device device;
+    FrameStats& stats;
+    uint32_t flags;
+    Granularity granularity;
+    VkQueryPool statisticsPool = VK_NULL_HANDLE;
+    VkQueryPool occlusionPool = VK_NULL_HANDLE;
+    VkQueryControlFlags occlusionControl = 0;
+    uint32_t framesInFlight;
+    uint32_t maxScopes;
+    uint32_t frame = 0;
+    std::vector<std::vector<Scope>> scopes;
+
+    VkQueryPool createPool(VkQueryType type, VkQueryPipelineStatisticFlags statistics);
+    void collect(uint32_t frameIndex);
+};
+
+class QueryScope {
+public:
+    QueryScope(QueryProfiler *profiler, VkCommandBuffer commandBuffer, const char *name,
+               QueryProfiler::Granularity level)
+    : profiler(profiler), commandBuffer(commandBuffer),
+      scope(profiler ? profiler->begin(commandBuffer, name, level) : 0) {}
+    ~QueryScope() {
+        if (profiler) {
+            profiler->end(commandBuffer, scope);
+        }
+    }
+
+private:
+    QueryProfiler *profiler;
+    VkCommandBuffer commandBuffer;
+    uint32_t scope;
+};
+
+// View frustum as six inward-facing planes (normal in xyz, distance in w),
+// normalized so a sphere is outside when dot(normal, center) + w < -radius.
+struct Frustum {
+    glm::vec4 planes[6];
+
+    static Frustum fromMatrix(const glm::mat4& viewProj);
+};
+
+// Bounding spheres stored as structure-of-arrays and tested against a
+// Frustum eight at a time. The AVX2, SSE2 or scalar kernel is picked once
+// at startup from the CPU's features.
+class CpuCulling {
+public:
+    uint32_t add(const glm::vec4& sphere);
+    void set(uint32_t object, const glm::vec4& sphere);
+    uint32_t size() const { return count; }
+    void clear();
+    void cull(const Frustum& frustum, std::vector<uint32_t>& visible) const;
+    static const char *isa();
+
+private:
+    // Padded to a multiple of eight with spheres that never pass.
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> radius;
+    uint32_t count = 0;
+};
+
+// Per-object data shared with cull.comp and scene.vert, std430 layout.
+struct ObjectData {
+    glm::mat4 model;
+    glm::vec4 sphere;
+};
+
+// GPU-driven drawing: cull.comp tests every object's bounding sphere against
+// the frustum and writes VkDrawIndexedIndirectCommands, which draw() consumes
+// with a single indirect call, so CPU cost does not grow with object count.
+// Requires multiDrawIndirect and drawIndirectFirstInstance; without
+// VK_KHR_draw_indirect_count culled objects are drawn with zero instances.
+class GpuCulling {
+public:
+    GpuCulling(std::shared_ptr<Device> deviceptr, ShaderCache& shaders,
+               LayoutCache& layouts, DescriptorAllocator& descriptors,
+               uint32_t maxObjects);
+    ~GpuCulling();
+    static bool supported(Device& device);
+    ObjectData *objects() { return mappedObjects; }
+    void setObjectCount(uint32_t count);
+    void cull(VkCommandBuffer commandBuffer, const glm::mat4& viewProj, uint32_t indexCount);
+    void draw(VkCommandBuffer commandBuffer, VkPipelineLayout layout);
+
+private:
+    struct CullConstants {
+        glm::vec4 planes[6];
+        uint32_t objectCount;
+        uint32_t indexCount;
+    };
+
+    std::shared_ptr<Device> deviceptr;
+    Device device;
+    std::unique_ptr<ComputePipeline> pipeline;
+    PFN_vkCmdDrawIndexedIndirectCountKHR drawIndirectCount = nullptr;
+    uint32_t maxObjects;
+    uint32_t objectCount = 0;
+    VkBuffer objectBuffer;
+    VkDeviceMemory objectMemory;
+    ObjectData *mappedObjects;
+    VkBuffer commandBuffer;
+    VkDeviceMemory commandMemory;
+    VkBuffer countBuffer;
+    VkDeviceMemory countMemory;
+    VkDescriptorSet cullSet;
+    VkDescriptorSet drawSet;
+};
+
+// Host-visible, persistently mapped instance buffer split into one region
+// per frame in flight. Each frame writes its region and binds it at an
+// offset, so the CPU never overwrites instances the GPU may still read.
+class InstanceRing {
+public:
+    InstanceRing(std::shared_ptr<Device> deviceptr, uint32_t framesInFlight,
+                 uint32_t capacity);
+    ~InstanceRing();
+    InstanceData *begin(uint32_t frameIndex);
+    void bind(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+    VkDeviceSize offset(uint32_t frameIndex) const;
+    uint32_t capacity() const { return instancesPerFrame; }
+    operator VkBuffer() const { return buffer; }
+
+private:
+    std::shared_ptr<Device> deviceptr;
+    Device device;
+    uint32_t framesInFlight;
+    uint32_t instancesPerFrame;
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    InstanceData *mapped;
+};
+
+// Cluster-level culling for meshes too large to cull as one object. Each
+// frame cluster.comp tests every meshlet's sphere against the frustum and
+// its normal cone against the camera, and writes the triangles of the
+// survivors into an index buffer drawn with one vkCmdDrawIndexedIndirect.
+// Needs no mesh shader support.
+class ClusterCulling {
+public:
+    ClusterCulling(std::shared_ptr<Device> deviceptr, ShaderCache& shaders,
+                   LayoutCache& layouts, DescriptorAllocator& descriptors,
+                   const MeshletData& data);
+    ~ClusterCulling();
+    void cull(VkCommandBuffer commandBuffer, const glm::mat4& viewProj,
+              const glm::mat4& model, const glm::vec3& camera);
+    void draw(VkCommandBuffer commandBuffer);
+
+private:
+    struct ClusterConstants {
+        glm::vec4 planes[6];
+        glm::vec4 camera;
+        uint32_t meshletCount;
+    };
+
+    std::shared_ptr<Device> deviceptr;
+    Device device;
+    std::unique_ptr<ComputePipeline> pipeline;
+    uint32_t meshletCount;
+    VkBuffer buffers[5];
+    VkDeviceMemory memory[5];
+    VkDescriptorSet set;
+
+    void upload(uint32_t binding, const void *data, VkDeviceSize size);
+};
+
+// Everything RenderQueue::record needs for one indexed draw. Handles are
+// raw so items can be compared and copied freely; pushConstants must stay
+// valid until the queue is recorded.
+struct DrawItem {
+    const char *name;
+    VkPipeline pipeline;
+    VkPipelineLayout layout;
+    VkDescriptorSet descriptorSet;
+    uint32_t vertexBufferCount;
+    VkBuffer vertexBuffers[2];
+    VkDeviceSize vertexOffsets[2];
+    VkBuffer indexBuffer;
+    VkDeviceSize indexOffset;
+    uint32_t indexCount;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t firstInstance;
+    const void *pushConstants;
+    uint32_t pushConstantSize;
+    VkShaderStageFlags pushStages;
+};
+
+// Draws are submitted in any order with a 64-bit sort key, radix sorted,
+// and recorded so that consecutive draws sharing a pipeline, descriptor set,
+// vertex or index buffer skip the redundant bind. Keys from makeKey() put
+// the pass first, then pipeline and material, so state changes cluster,
+// and depth last.
+class RenderQueue {
+public:
+    struct Stats {
+        uint32_t draws = 0;
+        uint32_t binds = 0;
+        uint32_t elided = 0;
+    };
+
+    RenderQueue(unsigned threads = JobSystem::get().workerCount() + 1);
+    static uint64_t makeKey(uint32_t pass, uint32_t pipeline, uint32_t material, float depth);
+    void submit(uint64_t key, const DrawItem& item);
+    void sort();
+    Stats record(VkCommandBuffer commandBuffer, QueryProfiler *queries = nullptr) const;
+    Stats record(VkCommandBuffer commandBuffer, size_t begin, size_t end,
+                 QueryProfiler *queries = nullptr) const;
+    void clear();
+    size_t size() const { return items.size(); }
+
+private:
+    unsigned threads;
+    std::vector<DrawItem> items;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> order;
+    std::vector<uint64_t> keyScratch;
+    std::vector<uint32_t> orderScratch;
+};
+
+// Records a sorted RenderQueue as contiguous partitions, one secondary
+// command buffer each, as jobs on the JobSystem. Every slot owns a
+// command pool per frame in flight. The primary executes the returned
+// buffers with vkCmdExecuteCommands in a render pass begun with
+// VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+class ParallelRecorder {
+public:
+    ParallelRecorder(std::shared_ptr<Device> deviceptr, uint32_t framesInFlight,
+                     unsigned slots = JobSystem::get().workerCount() + 1);
+    ~ParallelRecorder();
+    uint32_t partitions(size_t drawCount) const;
+    RenderQueue::Stats record(const RenderQueue& renderQueue, uint32_t frameIndex,
+                              const VkCommandBufferInheritanceInfo& inheritance,
+                              const std::function<void(VkCommandBuffer)>& setup,
+                              std::vector<VkCommandBuffer>& secondaries);
+
+private:
+    std::shared_ptr<Device> deviceptr;
+    Device device;
+    uint32_t framesInFlight;
+    unsigned slotCount;
+    // Indexed by slot * framesInFlight + frame.
+    std::vector<std::unique_ptr<CommandPool>> pools;
+    std::vector<VkCommandBuffer> buffers;
+};
+
+// Lock-free handoff of the latest value from one writer thread to one
+// reader thread. The writer fills back() and publishes it; the reader's
+// acquire() swaps in the newest published value, if there is one, and
+// front() stays valid until the next acquire(). Neither side blocks, and
+// values published while the reader was busy are skipped.
+template <typename T>
+class TripleBuffer {
+public:
+    T& back() { return slots[backIndex]; }
+
+    void publish() {
+        uint8_t previous = middle.exchange(backIndex | freshBit, std::memory_order_acq_rel);
+        backIndex = previous & indexMask;
+    }
+
+    // Returns true when front() changed.
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & freshBit)) {
+            return false;
+        }
+        uint8_t previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & indexMask;
+        return true;
+    }
+
+    const T& front() const { return slots[frontIndex]; }
+
+private:
+    static const uint8_t indexMask = 3;
+    static const uint8_t freshBit = 4;
+    T slots[3] = {};
+    uint8_t backIndex = 0;
+    uint8_t frontIndex = 1;
+    std::atomic<uint8_t> middle{2};
+};
+
 class Image {
 public:
     Image(uint32_t width, uint32_t height, std::shared_ptr<VkDevice> deviceptr,
           VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
-          VkMemoryPropertyFlags properties);
+          VkMemoryPropertyFlags properties,
+          MemoryCategory category = MEMORY_TEXTURE);
     operator VkImage();
     ~Image();
 
@@ -173,17 +953,20 @@ private:
 
 class CommandBuffer {
 public:
-    CommandBuffer(std::shared_ptr<Device> deviceptr, CommandPool commandPool);
+    CommandBuffer(std::shared_ptr<Device> deviceptr, CommandPool& commandPool);
     ~CommandBuffer();
     operator VkCommandBuffer() { return commandBuffer; }
     void submit();
 
+    static GpuProfiler *profiler;
+
 private:
 	std::shared_ptr<Device> deviceptr;
 	Device device;
-	CommandPool commandPool;
+	CommandPool& commandPool;
     VkCommandBuffer commandBuffer;
     virtual void execute() = 0;
+    virtual const char *name() const { return "upload"; }
     void beginSingleTimeCommands();
     void endSingleTimeCommands();
 };
@@ -191,11 +974,12 @@ private:
 class ImageTransitionCmdBuffer : public CommandBuffer {
 public:
     ImageTransitionCmdBuffer(std::shared_ptr<Device> deviceptr,
-                             CommandPool commandPool,
+                             CommandPool& commandPool,
                              Image image,
                              VkImageLayout oldLayout,
                              VkImageLayout newLayout);
     void execute();
+    const char *name() const { return "image transition"; }
 
 private:
     VkImageLayout oldLayout;
@@ -206,9 +990,10 @@ private:
 class CopyBufCmdBuffer : public CommandBuffer {
 public:
     CopyBufCmdBuffer(shared_ptr<Device> deviceptr,
-                     CommandPool commandPool,
+                     CommandPool& commandPool,
                      Buffer src,
                      Buffer dst);
+    const char *name() const { return "buffer copy"; }
 private:
     Buffer src;
     Buffer dst;
@@ -217,9 +1002,10 @@ private:
 class CopyImageCmdBuffer : public CommandBuffer {
 public:
     CopyImageCmdBuffer(shared_ptr<Device> deviceptr,
-                       CommandPool commandPool,
+                       CommandPool& commandPool,
                        Buffer source,
                        Buffer destination);
+    const char *name() const { return "image copy"; }
 private:
     Image src;
     Image dst;
@@ -227,7 +1013,7 @@ private:
 
 class Texture {
 public:
-    Texture(std::shared_ptr<Device> deviceptr, CommandPool commandPool);
+    Texture(std::shared_ptr<Device> deviceptr, CommandPool& commandPool);
     ~Texture();
 
 private:
@@ -239,16 +1025,76 @@ private:
     VkSampler sampler;
 };
 
+struct UniformBufferObject {
+    glm::mat4 view;
+    glm::mat4 proj;
+};
+
+struct PushConstants {
+    glm::mat4 mvp;
+    uint32_t materialIndex;
+};
+
+// Per-instance attributes for binding 1, starting at INSTANCE_LOCATION.
+struct InstanceData {
+    glm::mat4 model;
+};
+
 struct Vertex {
     glm::vec3 pos;
     glm::vec3 color;
     glm::vec2 texCoord;
 
-    VkVertexInputBindingDescription getBindingDescription();
-    std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions();
+    static const uint32_t INSTANCE_LOCATION = 3;
+
+    static std::vector<VkVertexInputBindingDescription> getBindingDescriptions(bool instanced = false);
+    static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(bool instanced = false);
     bool operator==(const Vertex& other) const;
 };
 
+// Sphere around all vertex positions as (center, radius).
+glm::vec4 boundingSphere(const std::vector<Vertex>& vertices);
+
+// One level of detail: a range of the shared index buffer and its geometric
+// error in model units.
+struct MeshLod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;
+};
+
+// One cluster of at most 64 vertices and 124 triangles, in the std430 layout
+// read by cluster.comp. cone.xyz is the average triangle normal and cone.w
+// the cutoff for the back-facing test.
+struct Meshlet {
+    glm::vec4 sphere;
+    glm::vec4 cone;
+    uint32_t vertexOffset;
+    uint32_t triangleOffset;
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+};
+
+struct MeshletData {
+    std::vector<Meshlet> meshlets;
+    // Mesh vertex index for each meshlet-local vertex.
+    std::vector<uint32_t> vertices;
+    // Three 8-bit local vertex indices per triangle.
+    std::vector<uint32_t> triangles;
+};
+
+MeshletData buildMeshlets(const std::vector<Vertex>& vertices, const uint32_t *indices,
+                          size_t indexCount, uint32_t maxVertices = 64,
+                          uint32_t maxTriangles = 124);
+
+std::vector<uint32_t> simplifyMesh(const std::vector<Vertex>& vertices,
+                                   const std::vector<uint32_t>& indices,
+                                   size_t targetIndexCount, float *error);
+std::vector<MeshLod> buildLods(const std::vector<Vertex>& vertices,
+                               std::vector<uint32_t>& indices, uint32_t levels = 5);
+uint32_t selectLod(const std::vector<MeshLod>& lods, float distance,
+                   float pixelsPerUnit, float maxPixels);
+
 namespace std {
     template<> struct hash<Vertex> {
         size_t operator()(Vertex const& vertex) const {
@@ -265,10 +1111,16 @@ public:
     ~Model();
 	void createIndexBuffer();
 	void createVertexBuffer();
+    const glm::vec4& bounds() const { return sphere; }
+    const std::vector<MeshLod>& lods() const { return levels; }
+    const MeshletData& meshlets() const { return clusters; }
 
 private:
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
+    glm::vec4 sphere;
+    std::vector<MeshLod> levels;
+    MeshletData clusters;
 
     Texture texture;
 };
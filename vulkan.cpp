@@ -15,11 +15,14 @@
 #include <fstream>
 #include <array>
 #include <ctime>
+#include <cmath>
+#include <algorithm>
 #include <unordered_map>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/hash.hpp>
 
+#include "vk.h"
 #include "vdeleter.h"
 #include "stb_image.h"
 #include "tiny_obj_loader.h"
@@ -30,21 +33,31 @@ const int HEIGHT = 600;
 const std::string MODEL_PATH = "model.obj";
 const std::string TEXTURE_PATH = "model.jpg";
 
-const std::vector<const char*> validationLayers = {
-    "VK_LAYER_LUNARG_standard_validation"
-};
-const bool enableValidationLayers = true;
+// Longest the event thread sleeps waiting for window events before it
+// publishes a new frame packet anyway.
+const double EVENT_INTERVAL = 1.0 / 240.0;
 
-struct UniformBufferObject {
+// Simulation state for one frame, written by the event thread and read by
+// the render thread. Never modified once published.
+struct FramePacket {
+    uint64_t frame;
     glm::mat4 model;
-    glm::mat4 view;
-    glm::mat4 proj;
+    glm::vec3 cameraPosition;
+    glm::vec3 cameraTarget;
 };
 
+
 class HelloTriangleApplication {
     public:
         void run() {
-            last_time = std::chrono::steady_clock::now();
+            const char *statsMode = getenv("VK_STATS");
+            frameStats.reset(new FrameStats(statsMode && strcmp(statsMode, "json") == 0));
+            std::cout << JobSystem::get().workerCount() << " job workers" << std::endl;
+            // VK_RECORD_BUDGET_MS=<ms> reports how many frames took longer
+            // than that to record.
+            if (const char *budget = getenv("VK_RECORD_BUDGET_MS")) {
+                frameStats->setBudget(FrameStats::RECORD, (uint64_t) (atof(budget) * 1000.0));
+            }
             initWindow();
             initVulkan();
             mainLoop();
@@ -52,20 +65,20 @@ class HelloTriangleApplication {
 
     private:
         GLFWwindow *window;
-        std::chrono::time_point<std::chrono::steady_clock> last_time;
-        double frames{0};
+        std::unique_ptr<FrameStats> frameStats;
+        std::vector<std::unique_ptr<CommandPool>> framePools;
         std::vector<VkCommandBuffer> commandBuffers;
         VDeleter<VkSemaphore> imageAvailableSemaphore{device, vkDestroySemaphore};
         VDeleter<VkSemaphore> renderFinishedSemaphore{device, vkDestroySemaphore};
         VDeleter<VkBuffer> vertexBuffer{device, vkDestroyBuffer};
-        VDeleter<VkDeviceMemory> vertexBufferMemory{device, vkFreeMemory};
+        VDeleter<VkDeviceMemory> vertexBufferMemory{trackedFree()};
         VDeleter<VkBuffer> indexBuffer{device, vkDestroyBuffer};
-        VDeleter<VkDeviceMemory> indexBufferMemory{device, vkFreeMemory};
+        VDeleter<VkDeviceMemory> indexBufferMemory{trackedFree()};
 
         VDeleter<VkBuffer> uniformStagingBuffer{device, vkDestroyBuffer};
-        VDeleter<VkDeviceMemory> uniformStagingBufferMemory{device, vkFreeMemory};
+        VDeleter<VkDeviceMemory> uniformStagingBufferMemory{trackedFree()};
         VDeleter<VkBuffer> uniformBuffer{device, vkDestroyBuffer};
-        VDeleter<VkDeviceMemory> uniformBufferMemory{device, vkFreeMemory};
+        VDeleter<VkDeviceMemory> uniformBufferMemory{trackedFree()};
 
         VDeleter<VkImage> stagingImage{device, vkDestroyImage};
         VDeleter<VkDeviceMemory> stagingImageMemory{device, vkFreeMemory};
@@ -75,12 +88,63 @@ class HelloTriangleApplication {
 
         VDeleter<VkSampler> textureSampler{device, vkDestroySampler};
 
-        VDeleter<VkImage> depthImage{device, vkDestroyImage};
-        VDeleter<VkDeviceMemory> depthImageMemory{device, vkFreeMemory};
+        std::unique_ptr<Image> depthImage;
         VDeleter<VkImageView> depthImageView{device, vkDestroyImageView};
 
         std::vector<Vertex> vertices;
         std::vector<uint32_t> indices;
+        PushConstants pushConstants = {};
+        std::unique_ptr<ShaderWatcher> shaderWatcher;
+        // Descriptions rebuilt from reloaded shaders, each paired with the
+        // one it replaces once its pipeline has compiled.
+        std::vector<std::pair<PipelineDesc*, PipelineDesc>> reloadedDescs;
+        PipelineDesc pipelineDesc;
+        std::unique_ptr<GpuProfiler> gpuProfiler;
+        std::unique_ptr<GpuProfiler> uploadProfiler;
+        std::unique_ptr<QueryProfiler> queryProfiler;
+        std::unique_ptr<AsyncCompute> asyncCompute;
+        std::unique_ptr<DescriptorAllocator> sceneDescriptors;
+        std::unique_ptr<GpuCulling> gpuCulling;
+        std::unique_ptr<ClusterCulling> clusterCulling;
+        PipelineDesc scenePipelineDesc;
+        std::unique_ptr<InstanceRing> instanceRing;
+        PipelineDesc instancePipelineDesc;
+        uint32_t instanceCount = 0;
+        std::vector<glm::vec3> instancePositions;
+        float instanceCullRadius = 0.0f;
+        CpuCulling instanceCulling;
+        std::vector<uint32_t> visibleInstances;
+        std::vector<uint32_t> lodInstanceCounts;
+        std::vector<MeshLod> lods;
+        glm::vec4 modelSphere;
+        float lodMaxPixels = 1.0f;
+        float pixelsPerUnit = 1.0f;
+        glm::vec3 cameraPosition;
+        glm::mat4 viewProj;
+        glm::mat4 modelMatrix;
+        RenderQueue renderQueue;
+        RenderQueue::Stats queueStats;
+        std::unique_ptr<ParallelRecorder> parallelRecorder;
+        std::vector<VkCommandBuffer> secondaryBuffers;
+        uint32_t drawCount = 0;
+        std::vector<glm::vec3> drawPositions;
+        std::vector<PushConstants> drawConstants;
+        CpuCulling drawCulling;
+        std::vector<uint32_t> visibleDraws;
+        TripleBuffer<FramePacket> framePackets;
+        std::atomic<bool> rendering{false};
+        std::exception_ptr renderError;
+        std::atomic<uint32_t> resizeRequests{0};
+        uint32_t resizesHandled = 0;
+        std::atomic<bool> memoryDumpRequested{false};
+
+        // Deleter for memory from createBuffer, which allocates through
+        // Device; freeing it the same way keeps the memory tracker in step.
+        std::function<void(VkDeviceMemory, VkAllocationCallbacks*)> trackedFree() {
+            return [this](VkDeviceMemory memory, VkAllocationCallbacks*) {
+                deviceptr->freeMemory(memory);
+            };
+        }
 
         void createSurface() {
             if (glfwCreateWindowSurface(instance, window, nullptr, surface.replace()) != VK_SUCCESS) {
@@ -89,71 +153,429 @@ class HelloTriangleApplication {
 
         }
 
+        // Command buffers are recorded every frame in drawFrame, so each
+        // swap chain image gets a transient pool holding just its primary,
+        // reset as a whole before re-recording. A resize that keeps the
+        // image count keeps the pools.
         void createCommandBuffers() {
-            if (commandBuffers.size() > 0) {
-                    vkFreeCommandBuffers(device, commandPool, commandBuffers.size(), commandBuffers.data());
+            if (framePools.size() == swapChainFramebuffers.size()) {
+                return;
             }
+            framePools.clear();
             commandBuffers.resize(swapChainFramebuffers.size());
-            VkCommandBufferAllocateInfo allocInfo = {};
-            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-            allocInfo.commandPool = commandPool;
-            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+            for (size_t i = 0; i < commandBuffers.size(); i++) {
+                framePools.emplace_back(new CommandPool(deviceptr, -1, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT));
+
+                VkCommandBufferAllocateInfo allocInfo = {};
+                allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                allocInfo.commandPool = *framePools[i];
+                allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+                allocInfo.commandBufferCount = 1;
+                if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffers[i]) != VK_SUCCESS) {
+                        throw std::runtime_error("failed to allocate command buffers!");
+                }
+                debug::setName(device, VK_OBJECT_TYPE_COMMAND_BUFFER,
+                               (uint64_t) commandBuffers[i], "frame command buffer");
+            }
+        }
 
+        void recordCommandBuffer(size_t i) {
+            framePools[i]->reset();
 
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            beginInfo.pInheritanceInfo = nullptr; // Optional
 
-            if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
-                    throw std::runtime_error("failed to allocate command buffers!");
+            vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
+            if (gpuProfiler) {
+                gpuProfiler->beginFrame(commandBuffers[i], i);
             }
+            if (queryProfiler) {
+                queryProfiler->beginFrame(commandBuffers[i], i);
+            }
+            {
+                GpuScope frameScope(gpuProfiler.get(), commandBuffers[i], "frame");
+                recordRenderPass(commandBuffers[i], i);
+            }
+            if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to record command buffer!");
+            }
+        }
 
-            for (size_t i = 0; i < commandBuffers.size(); i++) {
-                VkCommandBufferBeginInfo beginInfo = {};
-                beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-                beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-                beginInfo.pInheritanceInfo = nullptr; // Optional
+        void recordRenderPass(VkCommandBuffer commandBuffer, size_t i) {
+            VkRenderPassBeginInfo renderPassInfo = {};
+            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderPassInfo.renderPass = renderPass;
+            renderPassInfo.framebuffer = swapChainFramebuffers[i];
 
-                vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
+            renderPassInfo.renderArea.offset = {0, 0};
+            renderPassInfo.renderArea.extent = swapChainExtent;
 
-                VkRenderPassBeginInfo renderPassInfo = {};
-                renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-                renderPassInfo.renderPass = renderPass;
-                renderPassInfo.framebuffer = swapChainFramebuffers[i];
+            std::array<VkClearValue, 2> clearValues = {};
+            clearValues[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
+            clearValues[1].depthStencil = {1.0f, 0};
 
-                renderPassInfo.renderArea.offset = {0, 0};
-                renderPassInfo.renderArea.extent = swapChainExtent;
+            renderPassInfo.clearValueCount = clearValues.size();
+            renderPassInfo.pClearValues = clearValues.data();
 
-                std::array<VkClearValue, 2> clearValues = {};
-                clearValues[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
-                clearValues[1].depthStencil = {1.0f, 0};
+            GpuScope passScope(gpuProfiler.get(), commandBuffer, "main pass");
+
+            // The queue is built before the pass begins because its size
+            // decides whether draws are recorded inline or in secondaries.
+            bool queued = !gpuCulling && !clusterCulling;
+            if (queued) {
+                renderQueue.clear();
+                queueDraws(i);
+                renderQueue.sort();
+            }
+            bool parallel = queued && parallelRecorder
+                && parallelRecorder->partitions(renderQueue.size()) > 1;
+
+            // Secondaries must declare the pass queries they run under; the
+            // pass is left unqueried when the device cannot inherit them.
+            VkCommandBufferInheritanceInfo inheritance = {};
+            inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+            inheritance.renderPass = renderPass;
+            inheritance.framebuffer = swapChainFramebuffers[i];
+            bool passQueried = !parallel || !queryProfiler || queryProfiler->inherit(inheritance);
+            QueryScope passQuery(passQueried ? queryProfiler.get() : nullptr, commandBuffer,
+                                 "main pass", QueryProfiler::PER_PASS);
+            debug::beginLabel(commandBuffer, "main pass");
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+                                 parallel ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                                          : VK_SUBPASS_CONTENTS_INLINE);
+
+            // Until the specialized pipeline finishes compiling on the worker
+            // pool the draw is skipped rather than stalling the frame.
+            if (gpuCulling) {
+                auto pipeline = pipelineCompiler->find(scenePipelineDesc);
+                if (pipeline) {
+                    bindGeometry(commandBuffer, *pipeline);
+                    gpuCulling->draw(commandBuffer, *pipeline);
+                }
+            } else if (clusterCulling) {
+                auto pipeline = pipelineCompiler->find(pipelineDesc);
+                if (pipeline) {
+                    VkPipelineLayout pipelineLayout = *pipeline;
+                    bindGeometry(commandBuffer, *pipeline);
+                    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstants), &pushConstants);
+                    QueryScope drawQuery(queryProfiler.get(), commandBuffer, "model",
+                                         QueryProfiler::PER_DRAW);
+                    clusterCulling->draw(commandBuffer);
+                }
+            } else if (parallel) {
+                queueStats = parallelRecorder->record(renderQueue, i, inheritance,
+                                                      [this](VkCommandBuffer secondary) {
+                                                          setDynamicState(secondary);
+                                                      },
+                                                      secondaryBuffers);
+                vkCmdExecuteCommands(commandBuffer, secondaryBuffers.size(), secondaryBuffers.data());
+            } else {
+                setDynamicState(commandBuffer);
+                queueStats = renderQueue.record(commandBuffer, queryProfiler.get());
+            }
 
-                renderPassInfo.clearValueCount = clearValues.size();
-                renderPassInfo.pClearValues = clearValues.data();
+            vkCmdEndRenderPass(commandBuffer);
+            debug::endLabel(commandBuffer);
+        }
 
-                vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-                vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+        // The instanced and direct paths submit through the render queue,
+        // which orders draws by pipeline, material and depth and drops
+        // binds that repeat the previous draw's state.
+        void queueDraws(size_t i) {
+            if (instanceRing) {
+                auto pipeline = pipelineCompiler->find(instancePipelineDesc);
+                if (!pipeline) {
+                    return;
+                }
+                DrawItem item = geometryItem("instances", *pipeline);
+                item.vertexBufferCount = 2;
+                item.vertexBuffers[1] = *instanceRing;
+                item.vertexOffsets[1] = instanceRing->offset(i);
+                uint32_t pipelineId = instancePipelineDesc.key() >> 48;
+
+                // Instances are grouped by level in the ring, one draw each.
+                // Coarser levels are farther away, so the level stands in
+                // for depth.
+                uint32_t firstInstance = 0;
+                for (size_t level = 0; level < lodInstanceCounts.size(); level++) {
+                    uint32_t count = lodInstanceCounts[level];
+                    if (count) {
+                        item.indexCount = lods[level].indexCount;
+                        item.firstIndex = lods[level].firstIndex;
+                        item.instanceCount = count;
+                        item.firstInstance = firstInstance;
+                        float depth = (float) level / lods.size();
+                        renderQueue.submit(RenderQueue::makeKey(0, pipelineId, 0, depth), item);
+                    }
+                    firstInstance += count;
+                }
+                return;
+            }
 
-                VkBuffer vertexBuffers[] = {vertexBuffer};
-                VkDeviceSize offsets[] = {0};
-                vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+            auto pipeline = pipelineCompiler->find(pipelineDesc);
+            if (!pipeline) {
+                return;
+            }
+            if (drawCount) {
+                queueDrawGrid(*pipeline);
+                return;
+            }
+            DrawItem item = geometryItem("model", *pipeline);
+            glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(glm::vec3(modelSphere), 1.0f));
+            const MeshLod& lod = lods[lodFor(center, modelSphere.w)];
+            item.indexCount = lod.indexCount;
+            item.firstIndex = lod.firstIndex;
+            item.pushConstants = &pushConstants;
+            item.pushConstantSize = sizeof(PushConstants);
+            item.pushStages = VK_SHADER_STAGE_VERTEX_BIT;
+            glm::vec4 clip = viewProj * glm::vec4(center, 1.0f);
+            renderQueue.submit(RenderQueue::makeKey(0, pipelineDesc.key() >> 48,
+                                                    pushConstants.materialIndex, clip.z / clip.w),
+                               item);
+        }
 
-                vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-                vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        // One draw per visible copy, each with its own transform in push
+        // constants and its own level of detail.
+        void queueDrawGrid(Pipeline& pipeline) {
+            {
+                TRACE_SCOPE("cpu cull");
+                drawCulling.cull(Frustum::fromMatrix(viewProj), visibleDraws);
+            }
+            DrawItem item = geometryItem("model", pipeline);
+            item.pushConstantSize = sizeof(PushConstants);
+            item.pushStages = VK_SHADER_STAGE_VERTEX_BIT;
+            uint32_t pipelineId = pipelineDesc.key() >> 48;
+            for (size_t n = 0; n < visibleDraws.size(); n++) {
+                glm::vec3 position = drawPositions[visibleDraws[n]];
+                PushConstants& constants = drawConstants[n];
+                constants.mvp = viewProj * glm::translate(glm::mat4(), position) * modelMatrix;
+                constants.materialIndex = 0;
+                const MeshLod& lod = lods[lodFor(position, instanceCullRadius)];
+                item.indexCount = lod.indexCount;
+                item.firstIndex = lod.firstIndex;
+                item.pushConstants = &constants;
+                glm::vec4 clip = viewProj * glm::vec4(position, 1.0f);
+                renderQueue.submit(RenderQueue::makeKey(0, pipelineId, constants.materialIndex,
+                                                        clip.z / clip.w),
+                                   item);
+            }
+        }
 
+        // One instance of the model with descriptor set 0, ready for the
+        // caller to fill in the index range.
+        DrawItem geometryItem(const char *name, Pipeline& pipeline) {
+            DrawItem item = {};
+            item.name = name;
+            item.pipeline = pipeline;
+            item.layout = pipeline;
+            item.descriptorSet = descriptorSet;
+            item.vertexBufferCount = 1;
+            item.vertexBuffers[0] = vertexBuffer;
+            item.indexBuffer = indexBuffer;
+            item.instanceCount = 1;
+            return item;
+        }
 
-                vkCmdDrawIndexed(commandBuffers[i], indices.size(), 1, 0, 0, 0);
-                vkCmdEndRenderPass(commandBuffers[i]);
-                if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-                        throw std::runtime_error("failed to record command buffer!");
-                }
+        void setDynamicState(VkCommandBuffer commandBuffer) {
+            VkViewport viewport = {};
+            viewport.width = (float) swapChainExtent.width;
+            viewport.height = (float) swapChainExtent.height;
+            viewport.maxDepth = 1.0f;
+            vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+            VkRect2D scissor = {};
+            scissor.extent = swapChainExtent;
+            vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+        }
+
+        // Pipeline, dynamic state, the model's vertex and index buffers and
+        // descriptor set 0, for the GPU-culled and meshlet paths.
+        void bindGeometry(VkCommandBuffer commandBuffer, Pipeline& pipeline) {
+            VkPipelineLayout pipelineLayout = pipeline;
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            setDynamicState(commandBuffer);
+
+            VkBuffer vertexBuffers[] = {vertexBuffer};
+            VkDeviceSize offsets[] = {0};
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+
+            vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        }
+
+        // VK_GPU_CULLING=<count> replaces the single draw with a grid of
+        // copies of the model, culled on the compute queue.
+        void createGpuCulling() {
+            const char *count = getenv("VK_GPU_CULLING");
+            if (!count) {
+                return;
+            }
+            if (!GpuCulling::supported(*deviceptr)) {
+                std::cout << "GPU culling needs multiDrawIndirect and drawIndirectFirstInstance" << std::endl;
+                return;
+            }
+            uint32_t objects = std::max(1ul, strtoul(count, nullptr, 10));
+            sceneDescriptors.reset(new DescriptorAllocator(deviceptr));
+            gpuCulling.reset(new GpuCulling(deviceptr, shaderCache, layoutCache,
+                                            *sceneDescriptors, objects));
+
+            ObjectData *data = gpuCulling->objects();
+            for (uint32_t i = 0; i < objects; i++) {
+                data[i].model = glm::translate(glm::mat4(), gridPosition(i, objects, modelSphere.w));
+                data[i].sphere = modelSphere;
+            }
+            gpuCulling->setObjectCount(objects);
+
+            scenePipelineDesc = pipelineDesc;
+            scenePipelineDesc.vertShader = shaderCache.load("shaders/scene.spv", VK_SHADER_STAGE_VERTEX_BIT);
+        }
+
+        // VK_INSTANCES=<count> draws a grid of copies of the model with one
+        // instanced draw. Copies are frustum culled on the CPU and the
+        // visible transforms rewritten every frame through the mapped ring.
+        void createInstancing() {
+            const char *count = getenv("VK_INSTANCES");
+            if (!count || gpuCulling) {
+                return;
+            }
+            instanceCount = std::max(1ul, strtoul(count, nullptr, 10));
+
+            // Copies spin about their origin, so each culling sphere is
+            // centered there and large enough to cover every rotation.
+            instanceCullRadius = glm::length(glm::vec3(modelSphere)) + modelSphere.w;
+            instancePositions.resize(instanceCount);
+            instanceCulling.clear();
+            for (uint32_t i = 0; i < instanceCount; i++) {
+                instancePositions[i] = gridPosition(i, instanceCount, modelSphere.w);
+                instanceCulling.add(glm::vec4(instancePositions[i], instanceCullRadius));
+            }
+            std::cout << "instance culling with " << CpuCulling::isa() << std::endl;
+            instanceRing.reset(new InstanceRing(deviceptr, swapChainFramebuffers.size(),
+                                                instanceCount));
+
+            instancePipelineDesc = pipelineDesc;
+            instancePipelineDesc.vertShader = shaderCache.load("shaders/instanced.spv", VK_SHADER_STAGE_VERTEX_BIT);
+            instancePipelineDesc.instanced = VK_TRUE;
+        }
+
+        void updateInstances(uint32_t frameIndex) {
+            TRACE_SCOPE("updateInstances");
+            {
+                TRACE_SCOPE("cpu cull");
+                instanceCulling.cull(Frustum::fromMatrix(viewProj), visibleInstances);
+            }
+            frameStats->counter("visible instances", visibleInstances.size());
+
+            // Counting sort by level so each level is one contiguous run of
+            // instances and one draw.
+            std::vector<uint8_t> levels(visibleInstances.size());
+            lodInstanceCounts.assign(lods.size(), 0);
+            for (size_t i = 0; i < visibleInstances.size(); i++) {
+                levels[i] = lodFor(instancePositions[visibleInstances[i]], instanceCullRadius);
+                lodInstanceCounts[levels[i]]++;
+            }
+            std::vector<uint32_t> cursor(lods.size(), 0);
+            uint64_t triangles = 0;
+            for (size_t level = 1; level < lods.size(); level++) {
+                cursor[level] = cursor[level - 1] + lodInstanceCounts[level - 1];
+            }
+            for (size_t level = 0; level < lods.size(); level++) {
+                triangles += (uint64_t) lodInstanceCounts[level] * lods[level].indexCount / 3;
+            }
+            frameStats->counter("instance triangles", triangles);
+
+            InstanceData *data = instanceRing->begin(frameIndex);
+            for (size_t i = 0; i < visibleInstances.size(); i++) {
+                glm::vec3 position = instancePositions[visibleInstances[i]];
+                data[cursor[levels[i]]++].model = glm::translate(glm::mat4(), position) * modelMatrix;
             }
+        }
+
+        // VK_DRAWS=<count> draws the same grid as VK_INSTANCES but with one
+        // draw call per copy, for measuring CPU submission and recording.
+        void createDrawGrid() {
+            const char *count = getenv("VK_DRAWS");
+            if (!count || gpuCulling || instanceRing) {
+                return;
+            }
+            drawCount = std::max(1ul, strtoul(count, nullptr, 10));
+            instanceCullRadius = glm::length(glm::vec3(modelSphere)) + modelSphere.w;
+            drawPositions.resize(drawCount);
+            drawConstants.resize(drawCount);
+            drawCulling.clear();
+            for (uint32_t i = 0; i < drawCount; i++) {
+                drawPositions[i] = gridPosition(i, drawCount, modelSphere.w);
+                drawCulling.add(glm::vec4(drawPositions[i], instanceCullRadius));
+            }
+        }
 
+        // VK_RECORD_THREADS=<count> splits large render queues into up to
+        // that many secondary command buffers, recorded as parallel jobs.
+        void createParallelRecorder() {
+            const char *threads = getenv("VK_RECORD_THREADS");
+            if (!threads) {
+                return;
+            }
+            unsigned count = std::max(1ul, strtoul(threads, nullptr, 10));
+            parallelRecorder.reset(new ParallelRecorder(deviceptr, swapChainFramebuffers.size(), count));
+        }
+
+        // VK_MESHLETS=1 splits the full-detail model into meshlets that are
+        // frustum and back-face culled on the compute queue every frame.
+        // It replaces LOD selection for the single model.
+        void createClusterCulling() {
+            if (!getenv("VK_MESHLETS") || gpuCulling || instanceRing || drawCount) {
+                return;
+            }
+            MeshletData meshlets = buildMeshlets(vertices, indices.data(), lods[0].indexCount);
+            if (!sceneDescriptors) {
+                sceneDescriptors.reset(new DescriptorAllocator(deviceptr));
+            }
+            clusterCulling.reset(new ClusterCulling(deviceptr, shaderCache, layoutCache,
+                                                    *sceneDescriptors, meshlets));
+            std::cout << meshlets.meshlets.size() << " meshlets" << std::endl;
+        }
+
+        // Also caches the model's bounding sphere. Simplified levels are
+        // appended to indices and share the vertex array, so this runs
+        // before the index buffer is uploaded.
+        // VK_LOD_ERROR=<pixels> sets the allowed screen-space error.
+        void createLods() {
+            modelSphere = boundingSphere(vertices);
+            lods = buildLods(vertices, indices);
+            if (const char *pixels = getenv("VK_LOD_ERROR")) {
+                lodMaxPixels = strtof(pixels, nullptr);
+            }
+            std::cout << lods.size() << " levels of detail:";
+            for (const auto& lod : lods) {
+                std::cout << " " << lod.indexCount / 3;
+            }
+            std::cout << " triangles" << std::endl;
+        }
+
+        // Level for a sphere at center in world space, by the projected
+        // error at its nearest point.
+        uint32_t lodFor(const glm::vec3& center, float radius) {
+            float distance = glm::length(center - cameraPosition) - radius;
+            return selectLod(lods, distance, pixelsPerUnit, lodMaxPixels);
+        }
+
+        // Position of copy i in a cube of count copies centered on the origin.
+        glm::vec3 gridPosition(uint32_t i, uint32_t count, float radius) {
+            uint32_t side = (uint32_t) std::ceil(std::cbrt((double) count));
+            glm::vec3 offset(i % side, (i / side) % side, i / (side * side));
+            return (offset - glm::vec3((side - 1) * 0.5f)) * radius * 2.5f;
         }
 
         void createUniformBuffer() {
             VkDeviceSize bufferSize = sizeof(UniformBufferObject);
 
-            createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformStagingBuffer, uniformStagingBufferMemory);
-            createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, uniformBuffer, uniformBufferMemory);
+            createBuffer(*deviceptr, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformStagingBuffer, uniformStagingBufferMemory);
+            createBuffer(*deviceptr, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, uniformBuffer, uniformBufferMemory);
+            debug::setName(device, VK_OBJECT_TYPE_BUFFER, (uint64_t) (VkBuffer) uniformStagingBuffer, "uniform staging");
+            debug::setName(device, VK_OBJECT_TYPE_BUFFER, (uint64_t) (VkBuffer) uniformBuffer, "uniform");
         }
 
         bool hasStencilComponent(VkFormat format) {
@@ -163,37 +585,83 @@ class HelloTriangleApplication {
         void createDepthResources() {
             VkFormat depthFormat = findDepthFormat();
 
-            createImage(swapChainExtent.width, swapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
+            depthImage.reset(new Image(swapChainExtent.width, swapChainExtent.height, deviceptr, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_DEPTH));
 
-            createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, depthImageView);
+            createImageView(*depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, depthImageView);
 
-            transitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+            transitionImageLayout(*depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 
         }
 
         void initVulkan() {
             //createDepthResources();
+            createLods();
+
+            uploadProfiler.reset(new GpuProfiler(deviceptr, 1));
+            CommandBuffer::profiler = uploadProfiler.get();
+            gpuProfiler.reset(new GpuProfiler(deviceptr, swapChainFramebuffers.size()));
+
+            // VK_QUERY_STATS=pipeline,occlusion[,draw] enables per-pass (or
+            // per-draw) query counters in the frame statistics report.
+            QueryProfiler::Granularity granularity;
+            uint32_t queryFlags = QueryProfiler::parse(getenv("VK_QUERY_STATS"), granularity);
+            if (queryFlags) {
+                queryProfiler.reset(new QueryProfiler(deviceptr, *frameStats,
+                                                      swapChainFramebuffers.size(),
+                                                      queryFlags, granularity));
+            }
+
+            asyncCompute.reset(new AsyncCompute(deviceptr));
+            std::cout << "async compute on "
+                      << (asyncCompute->dedicatedQueue() ? "dedicated" : "graphics")
+                      << " queue family" << std::endl;
 
             createUniformBuffer();
+            createGpuCulling();
+            createInstancing();
+            createDrawGrid();
+            createClusterCulling();
+            createParallelRecorder();
             createCommandBuffers();
             createSemaphores();
+
+            if (getenv("VK_SHADER_HOT_RELOAD")) {
+                shaderWatcher.reset(new ShaderWatcher(shaderCache, "shaders"));
+            }
         }
 
         void recreateSwapChain() {
             vkDeviceWaitIdle(device);
+            pipelineCompiler->evict(renderPass);
 
             createSwapChain();
             createImageViews();
             createRenderPass();
-            createGraphicsPipeline();
+            pipelineDesc.renderPass = renderPass;
+            pipelineCompiler->compile(pipelineDesc);
+            if (gpuCulling) {
+                scenePipelineDesc.renderPass = renderPass;
+                pipelineCompiler->compile(scenePipelineDesc);
+            }
+            if (instanceRing) {
+                instancePipelineDesc.renderPass = renderPass;
+                pipelineCompiler->compile(instancePipelineDesc);
+            }
             createDepthResources();
             createFramebuffers();
             createCommandBuffers();
         }
 
         void drawFrame() {
+            TRACE_SCOPE("drawFrame");
             uint32_t imageIndex;
-            VkResult result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+            VkResult result;
+            {
+                TRACE_SCOPE("acquire");
+                auto start = FrameStats::Clock::now();
+                result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+                frameStats->record(FrameStats::ACQUIRE, start);
+            }
 
             if (result == VK_ERROR_OUT_OF_DATE_KHR) {
                     recreateSwapChain();
@@ -202,14 +670,51 @@ class HelloTriangleApplication {
                     throw std::runtime_error("failed to acquire swap chain image!");
             }
 
+            // Push constants are baked at record time. The uniform copy in
+            // updateUniformBuffer idles the queue, so neither the command
+            // buffers, their pools nor the instance ring region are pending.
+            if (gpuCulling) {
+                TRACE_SCOPE("cull");
+                VkCommandBuffer computeBuffer = asyncCompute->begin();
+                gpuCulling->cull(computeBuffer, viewProj, lods[0].indexCount);
+                asyncCompute->submit();
+            } else if (clusterCulling) {
+                TRACE_SCOPE("cluster cull");
+                VkCommandBuffer computeBuffer = asyncCompute->begin();
+                clusterCulling->cull(computeBuffer, viewProj, modelMatrix, cameraPosition);
+                asyncCompute->submit();
+            }
+            if (instanceRing) {
+                updateInstances(imageIndex);
+            }
+            {
+                TRACE_SCOPE("record");
+                auto start = FrameStats::Clock::now();
+                recordCommandBuffer(imageIndex);
+                frameStats->record(FrameStats::RECORD, start);
+            }
+            if (!gpuCulling && !clusterCulling) {
+                frameStats->counter("binds", queueStats.binds);
+                frameStats->counter("binds elided", queueStats.elided);
+            }
+
             VkSubmitInfo submitInfo = {};
             submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-            VkSemaphore waitSemaphores[] = {imageAvailableSemaphore};
-            VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-            submitInfo.waitSemaphoreCount = 1;
-            submitInfo.pWaitSemaphores = waitSemaphores;
-            submitInfo.pWaitDstStageMask = waitStages;
+            std::vector<VkSemaphore> waitSemaphores = {imageAvailableSemaphore};
+            std::vector<VkPipelineStageFlags> waitStages = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+            // Compute output is consumed as indirect arguments, vertex input
+            // or shader reads, so only those stages wait for it.
+            VkSemaphore computeDone = asyncCompute->takeSemaphore();
+            if (computeDone != VK_NULL_HANDLE) {
+                waitSemaphores.push_back(computeDone);
+                waitStages.push_back(VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT
+                                     | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT
+                                     | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
+            }
+            submitInfo.waitSemaphoreCount = waitSemaphores.size();
+            submitInfo.pWaitSemaphores = waitSemaphores.data();
+            submitInfo.pWaitDstStageMask = waitStages.data();
 
             submitInfo.commandBufferCount = 1;
             submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
@@ -218,8 +723,13 @@ class HelloTriangleApplication {
             submitInfo.signalSemaphoreCount = 1;
             submitInfo.pSignalSemaphores = signalSemaphores;
 
-            if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
-                    throw std::runtime_error("failed to submit draw command buffer!");
+            {
+                TRACE_SCOPE("submit");
+                auto start = FrameStats::Clock::now();
+                if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+                        throw std::runtime_error("failed to submit draw command buffer!");
+                }
+                frameStats->record(FrameStats::SUBMIT, start);
             }
 
             VkPresentInfoKHR presentInfo = {};
@@ -231,7 +741,11 @@ class HelloTriangleApplication {
             presentInfo.swapchainCount = 1;
             presentInfo.pSwapchains = swapChains;
             presentInfo.pImageIndices = &imageIndex;
-            vkQueuePresentKHR(presentQueue, &presentInfo);
+            {
+                TRACE_SCOPE("present");
+                vkQueuePresentKHR(presentQueue, &presentInfo);
+            }
+            frameStats->presented();
             if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
                     recreateSwapChain();
             } else if (result != VK_SUCCESS) {
@@ -253,35 +767,36 @@ class HelloTriangleApplication {
 
         }
 
-        void printFPS(){
-            auto now = std::chrono::steady_clock::now();
-            auto diff = std::chrono::duration_cast<std::chrono::seconds>(now - last_time);
-            auto count = diff.count();
-
-            frames++;
-            if (count > 1) {
-                std::cout << frames / count << " FPS" << std::endl;
-                last_time = now;
-                frames = 0;
-            }
-
-        }
-
-        void updateUniformBuffer() {
-            static auto startTime = std::chrono::high_resolution_clock::now();
-
+        // Runs on the event thread. Everything the render thread needs from
+        // the simulation travels in the packet.
+        void publishFrame(std::chrono::high_resolution_clock::time_point startTime, uint64_t frame) {
             auto currentTime = std::chrono::high_resolution_clock::now();
             float time = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - startTime).count() / 1000.0f;
 
+            FramePacket& packet = framePackets.back();
+            packet.frame = frame;
+            packet.model = glm::rotate(glm::mat4(), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+            packet.cameraPosition = glm::vec3(2.0f, 2.0f, 2.0f);
+            packet.cameraTarget = glm::vec3(0.0f, 0.0f, 0.0f);
+            framePackets.publish();
+        }
 
+        void updateUniformBuffer(const FramePacket& packet) {
+            TRACE_SCOPE("updateUniformBuffer");
             UniformBufferObject ubo = {};
-            ubo.model = glm::rotate(glm::mat4(), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+            modelMatrix = packet.model;
 
-            ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+            cameraPosition = packet.cameraPosition;
+            ubo.view = glm::lookAt(cameraPosition, packet.cameraTarget, glm::vec3(0.0f, 0.0f, 1.0f));
 
             ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float) swapChainExtent.height, 0.1f, 10.0f);
+            pixelsPerUnit = swapChainExtent.height * 0.5f * ubo.proj[1][1];
             ubo.proj[1][1] *= -1;
 
+            viewProj = ubo.proj * ubo.view;
+            pushConstants.mvp = viewProj * modelMatrix;
+            pushConstants.materialIndex = 0;
+
             void* data;
             vkMapMemory(device, uniformStagingBufferMemory, 0, sizeof(ubo), 0, &data);
             memcpy(data, &ubo, sizeof(ubo));
@@ -290,14 +805,121 @@ class HelloTriangleApplication {
             copyBuffer(uniformStagingBuffer, uniformBuffer, sizeof(ubo));
         }
 
+        // This thread owns the window: it handles events, runs the
+        // simulation and publishes a FramePacket per iteration. Recording
+        // and submission run on the render thread, so slow event handling
+        // never delays a submit.
         void mainLoop() {
-            while (!glfwWindowShouldClose(window)) {
-                glfwPollEvents();
-                updateUniformBuffer();
-                drawFrame();
-                printFPS();
+            auto startTime = std::chrono::high_resolution_clock::now();
+            publishFrame(startTime, 0);
+            rendering = true;
+            std::thread renderThread(&HelloTriangleApplication::renderLoop, this);
+            for (uint64_t frame = 1; rendering && !glfwWindowShouldClose(window); frame++) {
+                {
+                    TRACE_SCOPE("glfwWaitEvents");
+                    glfwWaitEventsTimeout(EVENT_INTERVAL);
+                    JobSystem::get().pumpMainThread();
+                }
+                publishFrame(startTime, frame);
             }
+            rendering = false;
+            renderThread.join();
+            if (renderError) {
+                std::rethrow_exception(renderError);
+            }
+
+           uint32_t benchmarkFrames = DebugConfig::get().benchmarkFrames;
            vkDeviceWaitIdle(device);
+           if (benchmarkFrames) {
+               std::cout << "benchmark: " << benchmarkFrames << " frames, validation "
+                         << DebugConfig::get().levelName() << std::endl;
+           }
+           frameStats->summary(std::cout);
+           dumpMemory();
+        }
+
+        // Renders the newest packet each frame; when the event thread has not
+        // published since, the previous one is drawn again. Window messages
+        // are applied here, between frames.
+        void renderLoop() {
+            try {
+                uint32_t benchmarkFrames = DebugConfig::get().benchmarkFrames;
+                for (uint32_t frame = 0; rendering; frame++) {
+                    if (benchmarkFrames && frame == benchmarkFrames) {
+                        break;
+                    }
+                    TRACE_SCOPE("frame");
+                    frameStats->beginFrame();
+                    framePackets.acquire();
+                    handleWindowMessages();
+                    reloadPipelines();
+                    updateUniformBuffer(framePackets.front());
+                    drawFrame();
+                    // GPU pass timings are only printed alongside the text report.
+                    if (frameStats->endFrame(std::cout) && !frameStats->json()) {
+                        gpuProfiler->report(std::cout);
+                        uploadProfiler->report(std::cout);
+                    }
+                }
+            } catch (...) {
+                renderError = std::current_exception();
+            }
+            rendering = false;
+            glfwPostEmptyEvent();
+        }
+
+        // After the watcher reloads a shader, every pipeline description
+        // looks its shaders up in the cache again and compiles the result.
+        // A description is swapped in between frames only once its pipeline
+        // is ready, so the old one keeps drawing meanwhile; the compiler
+        // keeps the old pipeline alive for frames still in flight. Compile
+        // errors keep the old description.
+        void reloadPipelines() {
+            if (!shaderWatcher) {
+                return;
+            }
+            if (shaderWatcher->takeReloaded()) {
+                reloadedDescs.clear();
+                for (PipelineDesc *desc : {&pipelineDesc, &scenePipelineDesc, &instancePipelineDesc}) {
+                    if (!desc->vertShader) {
+                        continue;
+                    }
+                    PipelineDesc reloaded = *desc;
+                    reloaded.vertShader = shaderCache.load(desc->vertShader->path(), VK_SHADER_STAGE_VERTEX_BIT);
+                    reloaded.fragShader = shaderCache.load(desc->fragShader->path(), VK_SHADER_STAGE_FRAGMENT_BIT);
+                    if (reloaded.vertShader != desc->vertShader || reloaded.fragShader != desc->fragShader) {
+                        reloadedDescs.emplace_back(desc, reloaded);
+                    }
+                }
+            }
+
+            for (auto it = reloadedDescs.begin(); it != reloadedDescs.end(); ) {
+                // Follows swap chain recreation while the compile is pending.
+                it->second.renderPass = it->first->renderPass;
+                auto future = pipelineCompiler->compile(it->second);
+                if (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                    ++it;
+                    continue;
+                }
+                try {
+                    future.get();
+                    *it->first = it->second;
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "pipeline rebuild: " << e.what() << std::endl;
+                }
+                it = reloadedDescs.erase(it);
+            }
+        }
+
+        void handleWindowMessages() {
+            uint32_t resizes = resizeRequests.load();
+            if (resizes != resizesHandled) {
+                resizesHandled = resizes;
+                recreateSwapChain();
+            }
+            if (memoryDumpRequested.exchange(false)) {
+                dumpMemory();
+            }
         }
 
         void initWindow() {
@@ -309,21 +931,47 @@ class HelloTriangleApplication {
 
             glfwSetWindowUserPointer(window, this);
             glfwSetWindowSizeCallback(window, HelloTriangleApplication::onWindowResized);
+            glfwSetKeyCallback(window, HelloTriangleApplication::onKey);
+        }
+
+        static void onKey(GLFWwindow* window, int key, int scancode, int action, int mods) {
+            if (key == GLFW_KEY_F12 && action == GLFW_PRESS) {
+                TRACE_DUMP("trace.json");
+            }
+            if (key == GLFW_KEY_F11 && action == GLFW_PRESS) {
+                auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+                app->memoryDumpRequested = true;
+            }
+        }
+
+        // Prints the live allocation report and writes memory.json.
+        void dumpMemory() {
+            deviceptr->memory().report(std::cout);
+            std::ofstream file("memory.json");
+            deviceptr->memory().dumpJson(file);
         }
 
         static void onWindowResized(GLFWwindow* window, int width, int height) {
             if (width == 0 || height == 0) return;
 
+            // Only counted here; the render thread recreates the swap chain
+            // at its next frame boundary.
             HelloTriangleApplication* app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
-            app->recreateSwapChain();
+            app->resizeRequests++;
         }
 };
 
-int main() {
+int main(int argc, char **argv) {
+    // Before the app, whose members size themselves by the worker count,
+    // so that this thread becomes the job system's main thread.
+    JobSystem::get();
     HelloTriangleApplication app;
 
     try {
+        DebugConfig::parse(argc, argv);
+        Device::parseSelection(argc, argv);
         app.run();
+        TRACE_DUMP("trace.json");
     } catch (const std::runtime_error& e) {
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;